@@ -5,4 +5,6 @@
  * LICENSE file in the root directory of this source tree.
  *)
 
-let () = Yojson_utils.run_converter_tool Clang_ast_j.read_decl Clang_ast_j.write_decl
+let () =
+  Yojson_utils.run_converter_tool ~biniou_reader:Clang_ast_b.read_decl
+    ~biniou_writer:Clang_ast_b.write_decl Clang_ast_j.read_decl Clang_ast_j.write_decl
@@ -13,25 +13,36 @@ end
 
 module PointerMap = Map.Make (PointerOrd)
 
-let declMap = ref PointerMap.empty
-
-let stmtMap = ref PointerMap.empty
+module PointerTbl = Hashtbl.Make (struct
+  type t = int
 
-let typeMap = ref PointerMap.empty
+  let equal (i: int) (j: int) = i = j
 
-let ivarToPropertyMap = ref PointerMap.empty
+  let hash (i: int) = i
+end)
 
 let empty_v = Clang_ast_visit.empty_visitor
 
-(* This function is not thread-safe *)
+(* Reentrant if a Clang_ast_visit.visitors_store is installed, otherwise not thread-safe *)
 let visit_ast ?(visit_decl= empty_v) ?(visit_stmt= empty_v) ?(visit_type= empty_v)
-    ?(visit_src_loc= empty_v) top_decl =
-  Clang_ast_visit.decl_visitor := visit_decl ;
-  Clang_ast_visit.stmt_visitor := visit_stmt ;
-  Clang_ast_visit.type_visitor := visit_type ;
-  Clang_ast_visit.source_location_visitor := visit_src_loc ;
-  (* visit *)
-  ignore (Clang_ast_v.validate_decl [] top_decl)
+    ?(visit_src_loc= empty_v) ?(visit_decl_ref= empty_v) top_decl =
+  match !Clang_ast_visit.visitors_store with
+  | None ->
+      Clang_ast_visit.decl_visitor := visit_decl ;
+      Clang_ast_visit.stmt_visitor := visit_stmt ;
+      Clang_ast_visit.type_visitor := visit_type ;
+      Clang_ast_visit.source_location_visitor := visit_src_loc ;
+      Clang_ast_visit.decl_ref_visitor := visit_decl_ref ;
+      (* visit *)
+      ignore (Clang_ast_v.validate_decl [] top_decl)
+  | Some store ->
+      let previous = store.Clang_ast_visit.get_visitors () in
+      store.Clang_ast_visit.set_visitors
+        {Clang_ast_visit.visit_decl; visit_stmt; visit_type; visit_src_loc; visit_decl_ref} ;
+      (* visit, restoring the visitors of an enclosing traversal *)
+      ( try ignore (Clang_ast_v.validate_decl [] top_decl) with e ->
+          store.Clang_ast_visit.set_visitors previous ; raise e ) ;
+      store.Clang_ast_visit.set_visitors previous
 
 
 let get_ptr_from_node node =
@@ -57,25 +68,52 @@ let add_node_to_cache node cache =
   cache := PointerMap.add key value !cache
 
 
-let process_decl _path decl =
-  add_node_to_cache (`DeclNode decl) declMap ;
+(* index from pointers to nodes, as a map or as a hash table *)
+type 'a pointer_index = Map of 'a PointerMap.t ref | Tbl of 'a PointerTbl.t
+
+let add_to_index index key value =
+  match index with
+  | Map map ->
+      map := PointerMap.add key value !map
+  | Tbl tbl ->
+      PointerTbl.replace tbl key value
+
+
+(* state of an indexing of an AST, see index_node_pointers *)
+type index_state =
+  { decls: Clang_ast_t.decl pointer_index
+  ; stmts: Clang_ast_t.stmt pointer_index
+  ; types: Clang_ast_t.c_type pointer_index
+  ; ivar_to_property: Clang_ast_t.decl pointer_index
+  ; (* name and type of the declarations referred to, see complete_decl_ref *)
+    decl_refs: (Clang_ast_t.named_decl_info option * Clang_ast_t.qual_type option) PointerTbl.t
+  ; (* files referred to by compact source locations *)
+    source_files: string array
+  ; (* files given along with their index, as in the frames of a framed output *)
+    frame_source_files: (int, string) Hashtbl.t
+  ; previous_sloc: Clang_ast_t.source_location }
+
+let process_decl state _path decl =
+  add_to_index state.decls (get_ptr_from_node (`DeclNode decl)) decl ;
   match decl with
   | Clang_ast_t.ObjCPropertyDecl (_, _, obj_c_property_decl_info) -> (
     match obj_c_property_decl_info.Clang_ast_t.opdi_ivar_decl with
     | Some decl_ref ->
         let ivar_pointer = decl_ref.Clang_ast_t.dr_decl_pointer in
-        ivarToPropertyMap := PointerMap.add ivar_pointer decl !ivarToPropertyMap
+        add_to_index state.ivar_to_property ivar_pointer decl
     | None ->
         () )
   | _ ->
       ()
 
 
-let add_stmt_to_cache _path stmt = add_node_to_cache (`StmtNode stmt) stmtMap
+let add_stmt_to_cache state _path stmt =
+  add_to_index state.stmts (get_ptr_from_node (`StmtNode stmt)) stmt
 
-let add_type_to_cache _path c_type = add_node_to_cache (`TypeNode c_type) typeMap
 
-let previous_sloc = {Clang_ast_t.sl_file= None; sl_line= None; sl_column= None}
+let add_type_to_cache state _path c_type =
+  add_to_index state.types (get_ptr_from_node (`TypeNode c_type)) c_type
+
 
 let get_sloc current previous = match current with None -> previous | Some _ -> current
 
@@ -83,34 +121,115 @@ let mutate_sloc sloc file line column =
   let open Clang_ast_t in
   sloc.sl_file <- file ;
   sloc.sl_line <- line ;
-  sloc.sl_column <- column
-
+  sloc.sl_column <- column ;
+  sloc.sl_file_index <- None ;
+  sloc.sl_column_delta <- None
 
-let reset_sloc sloc = mutate_sloc sloc None None None
 
-let complete_source_location _path source_loc =
+let complete_source_location state _path source_loc =
   let open Clang_ast_t in
-  let file = get_sloc source_loc.sl_file previous_sloc.sl_file in
+  let previous_sloc = state.previous_sloc in
+  let file =
+    match (source_loc.sl_file_index, source_loc.sl_file) with
+    | Some index, Some file ->
+        Hashtbl.replace state.frame_source_files index file ;
+        Some file
+    | Some index, None -> (
+      try Some (Hashtbl.find state.frame_source_files index) with Not_found ->
+        Some state.source_files.(index) )
+    | None, _ ->
+        get_sloc source_loc.sl_file previous_sloc.sl_file
+  in
   let line = get_sloc source_loc.sl_line previous_sloc.sl_line in
-  let column = get_sloc source_loc.sl_column previous_sloc.sl_column in
+  let column =
+    match (source_loc.sl_column_delta, previous_sloc.sl_column) with
+    | Some delta, Some column ->
+        Some (column + delta)
+    | _ ->
+        get_sloc source_loc.sl_column previous_sloc.sl_column
+  in
   mutate_sloc source_loc file line column ;
   mutate_sloc previous_sloc file line column
 
 
-let reset_cache () =
-  declMap := PointerMap.empty ;
-  stmtMap := PointerMap.empty ;
-  typeMap := PointerMap.empty ;
-  ivarToPropertyMap := PointerMap.empty ;
-  reset_sloc previous_sloc
+(* When the AST was exported with DEDUP_DECL_REFS, only the first reference to a declaration
+   carries its name and type: copy them to the later references. *)
+let complete_decl_ref state _path decl_ref =
+  let open Clang_ast_t in
+  let pointer = decl_ref.dr_decl_pointer in
+  match (decl_ref.dr_name, decl_ref.dr_qual_type) with
+  | None, None -> (
+    try
+      let name, qual_type = PointerTbl.find state.decl_refs pointer in
+      decl_ref.dr_name <- name ;
+      decl_ref.dr_qual_type <- qual_type
+    with Not_found -> () )
+  | name, qual_type ->
+      if not (PointerTbl.mem state.decl_refs pointer) then
+        PointerTbl.add state.decl_refs pointer (name, qual_type)
+
+
+let get_source_files top_decl =
+  match top_decl with
+  | Clang_ast_t.TranslationUnitDecl (_, _, _, tu_info) ->
+      Array.of_list tu_info.Clang_ast_t.tudi_source_files
+  | _ ->
+      [||]
+
+
+(* number of pointers in the AST, 0 for outputs of older exporters *)
+let get_pointer_count top_decl =
+  match top_decl with
+  | Clang_ast_t.TranslationUnitDecl (_, _, _, tu_info) ->
+      tu_info.Clang_ast_t.tudi_pointer_count
+  | _ ->
+      0
+
+
+(* Index nodes and complete source locations and decl refs in a single visit. All the state is in
+   [state], see visit_ast for reentrancy. *)
+let index_with_state state top_decl =
+  visit_ast ~visit_decl:(process_decl state) ~visit_stmt:(add_stmt_to_cache state)
+    ~visit_type:(add_type_to_cache state) ~visit_src_loc:(complete_source_location state)
+    ~visit_decl_ref:(complete_decl_ref state) top_decl
+
+
+let new_index_state top_decl decls stmts types ivar_to_property =
+  { decls
+  ; stmts
+  ; types
+  ; ivar_to_property
+  ; decl_refs= PointerTbl.create 64
+  ; source_files= get_source_files top_decl
+  ; frame_source_files= Hashtbl.create 16
+  ; previous_sloc=
+      { Clang_ast_t.sl_file= None
+      ; sl_line= None
+      ; sl_column= None
+      ; sl_file_index= None
+      ; sl_column_delta= None } }
 
 
-(* This function is not thread-safe *)
 let index_node_pointers top_decl =
-  (* just in case *)
-  reset_cache () ;
-  (* populate cache *)
-  visit_ast ~visit_decl:process_decl ~visit_stmt:add_stmt_to_cache ~visit_type:add_type_to_cache
-    ~visit_src_loc:complete_source_location top_decl ;
-  let result = (!declMap, !stmtMap, !typeMap, !ivarToPropertyMap) in
-  reset_cache () ; result
+  let decls = ref PointerMap.empty
+  and stmts = ref PointerMap.empty
+  and types = ref PointerMap.empty
+  and ivar_to_property = ref PointerMap.empty in
+  index_with_state
+    (new_index_state top_decl (Map decls) (Map stmts) (Map types) (Map ivar_to_property))
+    top_decl ;
+  (!decls, !stmts, !types, !ivar_to_property)
+
+
+(* Same as index_node_pointers, with hash tables presized from the number of pointers of the AST *)
+let index_node_pointers_in_tables top_decl =
+  (* decls, stmts and types share the pointers *)
+  let size = max 16 (get_pointer_count top_decl) in
+  let decls = PointerTbl.create size
+  and stmts = PointerTbl.create size
+  and types = PointerTbl.create size
+  and ivar_to_property = PointerTbl.create 16 in
+  index_with_state
+    (new_index_state top_decl (Tbl decls) (Tbl stmts) (Tbl types) (Tbl ivar_to_property))
+    top_decl ;
+  (decls, stmts, types, ivar_to_property)
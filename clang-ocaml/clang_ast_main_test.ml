@@ -50,6 +50,15 @@ let print_map_size map =
   prerr_string (string_of_int s ^ " ")
 
 
+(* both indexes hold the same pointers *)
+let check_same_index map tbl =
+  if Clang_ast_main.PointerMap.cardinal map <> Clang_ast_main.PointerTbl.length tbl then
+    raise PointerMismatch ;
+  Clang_ast_main.PointerMap.iter
+    (fun ptr _ -> if not (Clang_ast_main.PointerTbl.mem tbl ptr) then raise PointerMismatch)
+    map
+
+
 let check_decl_cache_from_file fname =
   let ast = Atdgen_runtime.Util.Json.from_file Clang_ast_j.read_decl fname in
   let decl_cache, stmt_cache, type_cache, _ = Clang_ast_main.index_node_pointers ast in
@@ -60,6 +69,12 @@ let check_decl_cache_from_file fname =
   Clang_ast_main.PointerMap.iter validate_decl_ptr decl_cache ;
   Clang_ast_main.PointerMap.iter validate_stmt_ptr stmt_cache ;
   Clang_ast_main.PointerMap.iter validate_type_ptr type_cache ;
+  (* the AST is mutated while indexing, index it again from the file *)
+  let ast_again = Atdgen_runtime.Util.Json.from_file Clang_ast_j.read_decl fname in
+  let decl_tbl, stmt_tbl, type_tbl, _ = Clang_ast_main.index_node_pointers_in_tables ast_again in
+  check_same_index decl_cache decl_tbl ;
+  check_same_index stmt_cache stmt_tbl ;
+  check_same_index type_cache type_tbl ;
   Clang_ast_main.visit_ast ~visit_decl:print_decl ~visit_stmt:print_stmt ast
 
 
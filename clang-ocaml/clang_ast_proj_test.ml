@@ -9,7 +9,8 @@ open Utils
 open Clang_ast_t
 open Clang_ast_proj
 
-let source_location ?file ?line ?column () = {sl_file= file; sl_line= line; sl_column= column}
+let source_location ?file ?line ?column () =
+  {sl_file= file; sl_line= line; sl_column= column; sl_file_index= None; sl_column_delta= None}
 
 let empty_source_location = source_location ()
 
@@ -53,7 +54,8 @@ let var_decl_info ~is_global =
 
 let stmt_info pointer =
   { si_pointer= pointer
-  ; si_source_range= (empty_source_location, empty_source_location) }
+  ; si_source_range= (empty_source_location, empty_source_location)
+  ; si_has_elided_children= false }
 
 let expr_info qual_type =
   { ei_qual_type= qual_type
@@ -13,6 +13,8 @@ type visit_type_t = Atdgen_runtime.Util.Validation.path -> Clang_ast_t.c_type ->
 
 type visit_src_loc_t = Atdgen_runtime.Util.Validation.path -> Clang_ast_t.source_location -> unit
 
+type visit_decl_ref_t = Atdgen_runtime.Util.Validation.path -> Clang_ast_t.decl_ref -> unit
+
 let empty_visitor _path _decl = ()
 
 let decl_visitor = ref (empty_visitor : visit_decl_t)
@@ -23,25 +25,68 @@ let type_visitor = ref (empty_visitor : visit_type_t)
 
 let source_location_visitor = ref (empty_visitor : visit_src_loc_t)
 
+let decl_ref_visitor = ref (empty_visitor : visit_decl_ref_t)
+
+(* visitors of a traversal, see visitors_store *)
+type visitors =
+  { visit_decl: visit_decl_t
+  ; visit_stmt: visit_stmt_t
+  ; visit_type: visit_type_t
+  ; visit_src_loc: visit_src_loc_t
+  ; visit_decl_ref: visit_decl_ref_t }
+
+type visitors_store = {get_visitors: unit -> visitors; set_visitors: visitors -> unit}
+
+(* The generated validators (Clang_ast_v) reach the visitors through this module only. When set,
+   the visitors are taken from this store instead of the refs above, e.g. to run traversals
+   concurrently in OCaml 5 domains with a store backed by [Domain.DLS]. *)
+let visitors_store = ref (None : visitors_store option)
+
 let visit_decl path decl =
-  !decl_visitor path decl ;
+  ( match !visitors_store with
+  | None ->
+      !decl_visitor path decl
+  | Some store ->
+      (store.get_visitors ()).visit_decl path decl ) ;
   (* return None to pass atd validation *)
   None
 
 
 let visit_stmt path stmt =
-  !stmt_visitor path stmt ;
+  ( match !visitors_store with
+  | None ->
+      !stmt_visitor path stmt
+  | Some store ->
+      (store.get_visitors ()).visit_stmt path stmt ) ;
   (* return None to pass atd validation *)
   None
 
 
 let visit_type path c_type =
-  !type_visitor path c_type ;
+  ( match !visitors_store with
+  | None ->
+      !type_visitor path c_type
+  | Some store ->
+      (store.get_visitors ()).visit_type path c_type ) ;
   (* return None to pass atd validation *)
   None
 
 
 let visit_source_loc path src_loc =
-  !source_location_visitor path src_loc ;
+  ( match !visitors_store with
+  | None ->
+      !source_location_visitor path src_loc
+  | Some store ->
+      (store.get_visitors ()).visit_src_loc path src_loc ) ;
+  (* return None to pass atd validation *)
+  None
+
+
+let visit_decl_ref path decl_ref =
+  ( match !visitors_store with
+  | None ->
+      !decl_ref_visitor path decl_ref
+  | Some store ->
+      (store.get_visitors ()).visit_decl_ref path decl_ref ) ;
   (* return None to pass atd validation *)
   None
@@ -6,74 +6,420 @@
  *)
 
 module U = Utils
-module P = Process
 
 (* Needed as a (pointer-stable) default value for atd specs. *)
 let empty_string = ""
 
+(* Same output as the ydump tool, without running it *)
+let format_json ?(compact_json= false) ?(std_json= false) json =
+  if compact_json then Yojson.Safe.to_string ~std:std_json json ^ "\n"
+  else Yojson.Safe.pretty_to_string ~std:std_json json ^ "\n"
+
+
 let ydump ?(compact_json= false) ?(std_json= false) ic oc =
-  let cmd =
-    ["ydump"] @ (if compact_json then ["-c"] else []) @ if std_json then ["-std"] else []
-  in
-  P.exec (Array.of_list cmd) ic oc stderr
-
-
-let read_data_from_file reader fname =
-  let input_gunzipped read_data ic =
-    let pid, icz = P.fork (P.gunzip ic) in
-    let data = read_data icz in
-    let r = P.wait pid in
-    P.close_in icz ;
-    if not r then failwith "read_data_from_file (gunzip)" else () ;
-    data
-  in
-  let ic = open_in fname in
-  let data =
-    if U.string_ends_with fname ".value.gz" then input_gunzipped Marshal.from_channel ic
-    else if U.string_ends_with fname ".gz" then
-      input_gunzipped (Atdgen_runtime.Util.Json.from_channel ~fname reader) ic
-    else if U.string_ends_with fname ".value" then Marshal.from_channel ic
-    else Atdgen_runtime.Util.Json.from_channel ~fname reader ic
-  in
-  close_in ic ; data
-
-
-let write_data_to_file ?(pretty= false) ?(compact_json= false) ?(std_json= false) writer fname data =
-  let output_gzipped write_data oc data =
-    let pid, icz = P.fork (fun ocz -> write_data ocz data ; true) in
-    let r1 = P.gzip icz oc and r2 = P.wait pid in
-    P.close_in icz ;
-    if not (r1 && r2) then failwith "write_data_to_file (gzip)" else ()
-  and output_pretty write_data oc data =
-    (* TODO(mathieubaudet): find out how to write directly pretty json? *)
-    let pid, icp = P.fork (fun ocp -> write_data ocp data ; true) in
-    let r1 = ydump ~compact_json ~std_json icp oc and r2 = P.wait pid in
-    P.close_in icp ;
-    if not (r1 && r2) then failwith "write_data_to_file (pretty)" else ()
-  in
-  let write_json ocx data =
-    if pretty then output_pretty (Atdgen_runtime.Util.Json.to_channel writer) ocx data
-    else Atdgen_runtime.Util.Json.to_channel writer ocx data
-  in
-  let oc = open_out fname in
-  if U.string_ends_with fname ".value.gz" then
-    output_gzipped (fun oc data -> Marshal.to_channel oc data []) oc data
-  else if U.string_ends_with fname ".value" then Marshal.to_channel oc data []
-  else if U.string_ends_with fname ".gz" then output_gzipped write_json oc data
-  else write_json oc data ;
-  close_out oc
-
-
-let convert ?(pretty= false) ?(compact_json= false) ?(std_json= false) reader writer fin fout =
+  let lexer_state = Yojson.Safe.init_lexer () in
+  let lexbuf = Lexing.from_channel ic in
+  let rec loop () =
+    match Yojson.Safe.from_lexbuf lexer_state ~stream:true lexbuf with
+    | exception Yojson.End_of_input ->
+        true
+    | json ->
+        output_string oc (format_json ~compact_json ~std_json json) ;
+        loop ()
+  in
+  try loop () with Yojson.Json_error s -> prerr_string s ; prerr_newline () ; false
+
+
+let is_biniou fname = U.string_ends_with fname ".biniou" || U.string_ends_with fname ".biniou.gz"
+
+(* content of a file, decompressed in-process if its name ends with .gz *)
+let read_file_contents fname =
+  if U.string_ends_with fname ".gz" then (
+    let icz = Gzip.open_in fname in
+    let buffer = Buffer.create 65536 and chunk = Bytes.create 65536 in
+    let rec loop () =
+      match Gzip.input icz chunk 0 (Bytes.length chunk) with
+      | 0 ->
+          ()
+      | len ->
+          Buffer.add_subbytes buffer chunk 0 len ;
+          loop ()
+    in
+    ( try loop () with
+    | Gzip.Error _ ->
+        Gzip.close_in icz ; failwith "read_file_contents (gunzip)"
+    | e ->
+        Gzip.close_in icz ; raise e ) ;
+    Gzip.close_in icz ; Buffer.contents buffer )
+  else
+    let ic = open_in_bin fname in
+    let contents = really_input_string ic (in_channel_length ic) in
+    close_in ic ; contents
+
+
+(* compress a file in-process, one chunk at a time *)
+let gzip_file src fname =
+  let ic = open_in_bin src in
+  let ocz = Gzip.open_out fname in
+  let chunk = Bytes.create 65536 in
+  let rec loop () =
+    match input ic chunk 0 (Bytes.length chunk) with
+    | 0 ->
+        ()
+    | len ->
+        Gzip.output ocz chunk 0 len ; loop ()
+  in
+  ( try loop () with e -> close_in ic ; Gzip.close_out ocz ; raise e ) ;
+  close_in ic ; Gzip.close_out ocz
+
+
+(* Call [write] on a channel to a temporary file, which is removed afterwards, and return the
+   result of [f] on its name *)
+let with_temp_file ?temp_dir write f =
+  let tmp = Filename.temp_file ?temp_dir "yojson_utils" ".tmp" in
+  let finally () = try Sys.remove tmp with Sys_error _ -> () in
+  try
+    let oc = open_out_bin tmp in
+    (try write oc with e -> close_out oc ; raise e) ;
+    close_out oc ;
+    let result = f tmp in
+    finally () ; result
+  with e -> finally () ; raise e
+
+
+(* Call [write] on a channel to [fname], which is compressed in-process if its name ends with .gz.
+   The output is streamed to the file, or to a temporary file next to it before compression,
+   instead of being built in memory. *)
+let with_output_file fname write =
+  if U.string_ends_with fname ".gz" then
+    with_temp_file ~temp_dir:(Filename.dirname fname) write (fun tmp -> gzip_file tmp fname)
+  else
+    let oc = open_out_bin fname in
+    (try write oc with e -> close_out oc ; raise e) ;
+    close_out oc
+
+
+let read_data_from_file ?biniou_reader reader fname =
+  (* decompressed in-process, without forking gunzip *)
+  let input_gunzipped read_data =
+    let icz = Gzip.open_in fname in
+    let data =
+      try read_data icz with
+      | Gzip.Error _ ->
+          Gzip.close_in icz ; failwith "read_data_from_file (gunzip)"
+      | e ->
+          Gzip.close_in icz ; raise e
+    in
+    Gzip.close_in icz ; data
+  in
+  let marshal_from_gzip icz =
+    let header = Bytes.create Marshal.header_size in
+    Gzip.really_input icz header 0 Marshal.header_size ;
+    let size = Marshal.total_size header 0 in
+    let buffer = Bytes.extend header 0 (size - Marshal.header_size) in
+    Gzip.really_input icz buffer Marshal.header_size (size - Marshal.header_size) ;
+    Marshal.from_bytes buffer 0
+  and json_from_gzip icz =
+    let lexbuf = Lexing.from_function (fun buffer len -> Gzip.input icz buffer 0 len) in
+    Atdgen_runtime.Util.Json.from_lexbuf reader (Yojson.Safe.init_lexer ~fname ()) lexbuf
+  in
+  if is_biniou fname then
+    match biniou_reader with
+    | Some read ->
+        read (Bi_inbuf.from_string (read_file_contents fname))
+    | None ->
+        failwith "read_data_from_file (no biniou reader)"
+  else if U.string_ends_with fname ".value.gz" then input_gunzipped marshal_from_gzip
+  else if U.string_ends_with fname ".gz" then input_gunzipped json_from_gzip
+  else
+    let ic = open_in fname in
+    let data =
+      if U.string_ends_with fname ".value" then Marshal.from_channel ic
+      else Atdgen_runtime.Util.Json.from_channel ~fname reader ic
+    in
+    close_in ic ; data
+
+
+(* With DECL_STORE_DIR, the frames moved to the store are replaced by "ASTSTORE" followed by the MD5 of
+   their content in hex, which is the name of their file in the store (see libtooling/DeclStore.h).
+   They are left as is without [decl_store]. *)
+let store_reference_magic = "ASTSTORE"
+
+let resolve_store_reference ?decl_store frame =
+  let magic_len = String.length store_reference_magic in
+  match decl_store with
+  | Some dir
+    when String.length frame = magic_len + 32 && String.sub frame 0 magic_len = store_reference_magic
+    ->
+      read_file_contents (Filename.concat dir (String.sub frame magic_len 32))
+  | _ ->
+      frame
+
+
+(* Framed outputs of the exporter (FRAMED_OUTPUT) are a sequence of values, each one prefixed
+   with its length as a 32-bit big-endian integer. *)
+let iter_raw_frames_from_file f fname =
+  let ic = open_in_bin fname in
+  let read_frame () =
+    match input_byte ic with
+    | exception End_of_file ->
+        None
+    | b0 ->
+        let b1 = input_byte ic in
+        let b2 = input_byte ic in
+        let b3 = input_byte ic in
+        let len = (b0 lsl 24) lor (b1 lsl 16) lor (b2 lsl 8) lor b3 in
+        Some (really_input_string ic len)
+  in
+  let rec loop () =
+    match read_frame () with
+    | None ->
+        ()
+    | Some frame ->
+        f frame ; loop ()
+  in
+  ( try loop () with e -> close_in ic ; raise e ) ;
+  close_in ic
+
+
+let iter_frames_from_file ?decl_store f fname =
+  iter_raw_frames_from_file (fun frame -> f (resolve_store_reference ?decl_store frame)) fname
+
+
+(* Frames are kept encoded, which is much more compact than their values, until they are forced.
+   Frames of the store are read when forced too. *)
+let lazy_frames_from_file ?decl_store decode fname =
+  let frames = ref [] in
+  iter_raw_frames_from_file
+    (fun frame -> frames := lazy (decode (resolve_store_reference ?decl_store frame)) :: !frames)
+    fname ;
+  Array.of_list (List.rev !frames)
+
+
+(* With WRITE_INDEX, the last frame of a framed output is an index of the frames by decl pointer and
+   by mangled name hash (see ASTExporter::dumpFrameIndex). Only the index is read when opening the
+   file, frames are then read on demand. *)
+type frame_index =
+  { fi_channel: in_channel
+  ; fi_decl_store: string option
+  ; fi_index: string
+  ; fi_num_decls: int
+  ; fi_num_mangled_names: int }
+
+(* Unsigned big-endian integers *)
+let int64_of_bytes s pos len =
+  let rec loop i acc =
+    if i >= len then acc
+    else loop (i + 1) (Int64.logor (Int64.shift_left acc 8) (Int64.of_int (Char.code s.[pos + i])))
+  in
+  loop 0 0L
+
+
+let int_of_bytes s pos len = Int64.to_int (int64_of_bytes s pos len)
+
+let open_frame_index ?decl_store fname =
+  let ic = open_in_bin fname in
   try
-    read_data_from_file reader fin
-    |> write_data_to_file writer ~pretty ~compact_json ~std_json fout
+    let len = in_channel_length ic in
+    if len < 16 then failwith "open_frame_index (no index)" else () ;
+    seek_in ic (len - 16) ;
+    let trailer = really_input_string ic 16 in
+    if String.sub trailer 8 8 <> "ASTINDEX" then failwith "open_frame_index (no index)" else () ;
+    (* skip the length of the index frame *)
+    let index_offset = int_of_bytes trailer 0 8 + 4 in
+    seek_in ic index_offset ;
+    let index = really_input_string ic (len - 16 - index_offset) in
+    let num_decls = int_of_bytes index 0 4 in
+    let num_mangled_names = int_of_bytes index (4 + (16 * num_decls)) 4 in
+    { fi_channel= ic
+    ; fi_decl_store= decl_store
+    ; fi_index= index
+    ; fi_num_decls= num_decls
+    ; fi_num_mangled_names= num_mangled_names }
+  with e -> close_in ic ; raise e
+
+
+let close_frame_index fi = close_in fi.fi_channel
+
+let read_frame_at fi offset =
+  seek_in fi.fi_channel offset ;
+  let header = really_input_string fi.fi_channel 4 in
+  resolve_store_reference ?decl_store:fi.fi_decl_store
+    (really_input_string fi.fi_channel (int_of_bytes header 0 4))
+
+
+(* Offsets of the frames registered under [key] in the table starting at [pos], in order.
+   Keys are compared as unsigned integers. *)
+let find_frame_offsets fi pos num key =
+  let unsigned x = Int64.add x Int64.min_int in
+  let key_at i = unsigned (int64_of_bytes fi.fi_index (pos + (16 * i)) 8) in
+  let key = unsigned key in
+  let rec lower_bound lo hi =
+    if lo >= hi then lo
+    else
+      let mid = (lo + hi) / 2 in
+      if compare (key_at mid) key < 0 then lower_bound (mid + 1) hi else lower_bound lo mid
+  in
+  let rec collect i acc =
+    if i >= num || key_at i <> key then List.rev acc
+    else
+      let offset = int_of_bytes fi.fi_index (pos + (16 * i) + 8) 8 in
+      match acc with
+      | last :: _ when last = offset ->
+          collect (i + 1) acc
+      | _ ->
+          collect (i + 1) (offset :: acc)
+  in
+  collect (lower_bound 0 num) []
+
+
+let find_decl_frame fi pointer =
+  match find_frame_offsets fi 4 fi.fi_num_decls (Int64.of_int pointer) with
+  | [] ->
+      None
+  | offset :: _ ->
+      Some (read_frame_at fi offset)
+
+
+let find_mangled_name_frames fi mangled_name =
+  (* mangled names are exported as unsigned 64-bit decimal numbers *)
+  let hash = ref 0L in
+  String.iter
+    (fun c -> hash := Int64.add (Int64.mul !hash 10L) (Int64.of_int (Char.code c - Char.code '0')))
+    mangled_name ;
+  List.map (read_frame_at fi)
+    (find_frame_offsets fi (8 + (16 * fi.fi_num_decls)) fi.fi_num_mangled_names !hash)
+
+
+(* With INTERN_STRINGS, the strings of 8 bytes or more repeated within a top-level value are
+   written as '\001' followed by the number of their first occurrence, where the strings of that
+   size written in full are numbered from 0 in order, and strings starting with '\001' have it
+   doubled (see GenWriter::emitInternedString). The numbering restarts with each top-level value,
+   so each frame of a framed output can be expanded on its own. *)
+let interned_string_marker = '\001'
+
+let min_interned_string_size = 8
+
+(* [f] is applied to the elements in order, as the numbering of strings depends on it *)
+let map_in_order f l = List.rev (List.rev_map f l)
+
+(* Readers must number the same strings as GenWriter::emitInternedString: every string value of the
+   output, which includes the constructors of variants in standard JSON but neither the constructors
+   of Yojson variants nor the names of fields. *)
+let make_interned_strings_expander () =
+  let strings = Hashtbl.create 1024 in
+  let intern s =
+    if String.length s >= min_interned_string_size then
+      Hashtbl.add strings (Hashtbl.length strings) s ;
+    s
+  in
+  fun s ->
+    let len = String.length s in
+    if len = 0 || s.[0] <> interned_string_marker then intern s
+    else if len > 1 && s.[1] = interned_string_marker then intern (String.sub s 1 (len - 1))
+    else
+      Hashtbl.find strings (int_of_string (String.sub s 1 (len - 1)))
+
+
+let expand_interned_strings_json contents =
+  let rec expand_json expand = function
+    | `String s ->
+        `String (expand s)
+    | `Assoc fields ->
+        `Assoc (map_in_order (fun (k, v) -> (k, expand_json expand v)) fields)
+    | `List l ->
+        `List (map_in_order (expand_json expand) l)
+    | `Tuple l ->
+        `Tuple (map_in_order (expand_json expand) l)
+    | `Variant (c, Some v) ->
+        `Variant (c, Some (expand_json expand v))
+    | json ->
+        json
+  in
+  let lexer_state = Yojson.Safe.init_lexer () in
+  let lexbuf = Lexing.from_string contents in
+  let buffer = Buffer.create (String.length contents) in
+  let rec loop () =
+    match Yojson.Safe.from_lexbuf lexer_state ~stream:true lexbuf with
+    | exception Yojson.End_of_input ->
+        ()
+    | json ->
+        let json = expand_json (make_interned_strings_expander ()) json in
+        Buffer.add_string buffer (Yojson.Safe.to_string json) ;
+        Buffer.add_char buffer '\n' ;
+        loop ()
+  in
+  loop () ; Buffer.contents buffer
+
+
+let expand_interned_strings_biniou contents =
+  (* elements of arrays are expanded in order by Array.map *)
+  let rec expand_tree expand = function
+    | `String s ->
+        `String (expand s)
+    | `Array (Some (tag, elements)) ->
+        `Array (Some (tag, Array.map (expand_tree expand) elements))
+    | `Tuple elements ->
+        `Tuple (Array.map (expand_tree expand) elements)
+    | `Record fields ->
+        `Record (Array.map (fun (name, hash, v) -> (name, hash, expand_tree expand v)) fields)
+    | `Num_variant (n, Some v) ->
+        `Num_variant (n, Some (expand_tree expand v))
+    | `Variant (name, hash, Some v) ->
+        `Variant (name, hash, Some (expand_tree expand v))
+    | tree ->
+        tree
+  in
+  let ib = Bi_inbuf.from_string contents in
+  let ob = Bi_outbuf.create (String.length contents) in
+  while Bi_inbuf.try_preread ib 1 > 0 do
+    Bi_io.write_tree ob (expand_tree (make_interned_strings_expander ()) (Bi_io.read_tree ib))
+  done ;
+  Bi_outbuf.contents ob
+
+
+let expand_interned_strings ~biniou contents =
+  if biniou then expand_interned_strings_biniou contents else expand_interned_strings_json contents
+
+
+let write_data_to_file ?(pretty= false) ?(compact_json= false) ?(std_json= false) ?biniou_writer
+    writer fname data =
+  (* pretty printing needs the tree of each value, as ydump does, but not the output as a string *)
+  let write_pretty_json oc =
+    with_temp_file
+      (fun tmp_oc -> Atdgen_runtime.Util.Json.to_channel writer tmp_oc data)
+      (fun tmp ->
+        let ic = open_in_bin tmp in
+        let ok = ydump ~compact_json ~std_json ic oc in
+        close_in ic ;
+        if not ok then failwith "write_data_to_file (pretty)" )
+  in
+  let write =
+    if is_biniou fname then (
+      match biniou_writer with
+      | Some write ->
+          fun oc -> Atdgen_runtime.Util.Biniou.to_channel write oc data
+      | None ->
+          failwith "write_data_to_file (no biniou writer)" )
+    else if U.string_ends_with fname ".value.gz" || U.string_ends_with fname ".value" then
+      fun oc -> Marshal.to_channel oc data []
+    else if pretty then write_pretty_json
+    else fun oc -> Atdgen_runtime.Util.Json.to_channel writer oc data
+  in
+  with_output_file fname write
+
+
+let convert ?(pretty= false) ?(compact_json= false) ?(std_json= false) ?biniou_reader
+    ?biniou_writer reader writer fin fout =
+  try
+    read_data_from_file ?biniou_reader reader fin
+    |> write_data_to_file ?biniou_writer writer ~pretty ~compact_json ~std_json fout
   with
   | Yojson.Json_error s | Atdgen_runtime.Oj_run.Error s ->
       prerr_string s ; prerr_newline () ; exit 1
 
 
-let run_converter_tool reader writer =
+let run_converter_tool ?biniou_reader ?biniou_writer reader writer =
   let pretty = ref false
   and std_json = ref false
   and compact_json = ref false
@@ -83,6 +429,7 @@ let run_converter_tool reader writer =
     "Usage: " ^ Sys.argv.(0) ^ "[OPTIONS] INPUT_FILE [OUTPUT_FILE]\n"
     ^ "Parse yojson values and convert them to another format based on the extension"
     ^ " of the output file (default: ${INPUT_FILE}.value.gz).\n"
+    ^ "Files named *.biniou or *.biniou.gz are read or written in biniou format when supported.\n"
   in
   let spec =
     Utils.fix_arg_spec
@@ -102,5 +449,35 @@ let run_converter_tool reader writer =
     | _ ->
         prerr_string usage_msg ; exit 1
   in
-  convert ~pretty:!pretty ~std_json:!std_json ~compact_json:!compact_json reader writer input
-    output
+  convert ~pretty:!pretty ~std_json:!std_json ~compact_json:!compact_json ?biniou_reader
+    ?biniou_writer reader writer input output
+
+
+(* Check that files respect the ATD specification of [reader] and [writer]: reading and writing
+   them back must give the same json. *)
+let make_yojson_validator reader writer argv =
+  let std_json, files =
+    match Array.to_list argv with
+    | _ :: "--std" :: files ->
+        (true, files)
+    | _ :: files ->
+        (false, files)
+    | [] ->
+        (false, [])
+  in
+  let validate fname =
+    let expected =
+      format_json ~std_json (read_data_from_file Yojson.Safe.read_json fname)
+    and converted =
+      read_data_from_file reader fname
+      |> Atdgen_runtime.Util.Json.to_string writer |> Yojson.Safe.from_string
+      |> format_json ~std_json
+    in
+    if expected <> converted then (
+      Printf.printf "The file '%s' does not respect the ATD format implemented by %s.\n" fname
+        argv.(0) ;
+      exit 2 )
+  in
+  try List.iter validate files with
+  | Yojson.Json_error s | Atdgen_runtime.Oj_run.Error s ->
+      prerr_string s ; prerr_newline () ; exit 1
@@ -5,15 +5,62 @@
  * LICENSE file in the root directory of this source tree.
  *)
 
-val read_data_from_file : 'a Atdgen_runtime.Util.Json.reader -> string -> 'a
+val read_data_from_file :
+  ?biniou_reader:'a Atdgen_runtime.Util.Biniou.reader -> 'a Atdgen_runtime.Util.Json.reader
+  -> string -> 'a
+(** Read a file according to its extension: *.biniou(.gz) with [biniou_reader], *.value(.gz) with
+    Marshal, json otherwise. Compressed files are decompressed in-process. *)
+
+val iter_frames_from_file : ?decl_store:string -> (string -> unit) -> string -> unit
+(** Call the function on the content of each frame of a framed output, in order. Frames can be
+    decoded with e.g. [Clang_ast_j.decl_of_string] or [Clang_ast_b.decl_of_string]. With
+    [decl_store], the directory given as DECL_STORE_DIR, the frames moved to the store are read from
+    it, otherwise their references are given as is. *)
+
+val lazy_frames_from_file : ?decl_store:string -> (string -> 'a) -> string -> 'a Lazy.t array
+(** Frames of a framed output, each one decoded with the function on first access, e.g. to only
+    decode the top-level decls of interest. See [iter_frames_from_file] for [decl_store]. *)
+
+type frame_index
+
+val open_frame_index : ?decl_store:string -> string -> frame_index
+(** Open a framed output ending with an index (WRITE_INDEX). Only the index is read. See
+    [iter_frames_from_file] for [decl_store]. *)
+
+val close_frame_index : frame_index -> unit
+
+val find_decl_frame : frame_index -> int -> string option
+(** Content of the top-level frame holding the decl with the given pointer. *)
+
+val find_mangled_name_frames : frame_index -> string -> string list
+(** Contents of the top-level frames holding a decl with the given [mangled_name]. *)
+
+val expand_interned_strings : biniou:bool -> string -> string
+(** Replace the references to repeated strings of an output exported with INTERN_STRINGS, or of a
+    frame of it, by the strings they refer to, which gives back an output that the readers of
+    [Clang_ast_j] or [Clang_ast_b] can decode. JSON values are written back compact. This only saves
+    space in the exported files: the values decoded from the expanded output do not share their
+    strings. *)
 
 val write_data_to_file :
-  ?pretty:bool -> ?compact_json:bool -> ?std_json:bool -> 'a Atdgen_runtime.Util.Json.writer
+  ?pretty:bool -> ?compact_json:bool -> ?std_json:bool
+  -> ?biniou_writer:'a Atdgen_runtime.Util.Biniou.writer -> 'a Atdgen_runtime.Util.Json.writer
   -> string -> 'a -> unit
+(** Write a file according to its extension, as read by [read_data_from_file]. The output is
+    streamed to the file, or to a temporary file next to it when compressed, rather than built in
+    memory. *)
 
 val ydump : ?compact_json:bool -> ?std_json:bool -> in_channel -> out_channel -> bool
+(** Same as the ydump tool, in-process. *)
 
 val empty_string : string
 
 val run_converter_tool :
-  'a Atdgen_runtime.Util.Json.reader -> 'a Atdgen_runtime.Util.Json.writer -> unit
+  ?biniou_reader:'a Atdgen_runtime.Util.Biniou.reader
+  -> ?biniou_writer:'a Atdgen_runtime.Util.Biniou.writer -> 'a Atdgen_runtime.Util.Json.reader
+  -> 'a Atdgen_runtime.Util.Json.writer -> unit
+
+val make_yojson_validator :
+  'a Atdgen_runtime.Util.Json.reader -> 'a Atdgen_runtime.Util.Json.writer -> string array -> unit
+(** Exit with an error if a file given on the command line (after an optional --std) does not
+    respect the ATD specification implemented by the reader and the writer. *)
@@ -8,7 +8,8 @@
 open Clang_ast_j
 open Yojson_utils
 
-let data = {sl_file= Some "foo"; sl_line= Some 1; sl_column= None}
+let data =
+  {sl_file= Some "foo"; sl_line= Some 1; sl_column= None; sl_file_index= None; sl_column_delta= None}
 
 let basic_test pretty name =
   write_data_to_file ~pretty write_source_location name data ;
@@ -22,3 +23,156 @@ let files = List.map (( ^ ) "yojson_utils_test_tmpfile") [".gz"; ".value"; ".val
 let test1 = List.iter (basic_test false) files
 
 let test2 = List.iter (basic_test true) files
+
+let biniou_test name =
+  write_data_to_file ~biniou_writer:Clang_ast_b.write_source_location write_source_location name
+    data ;
+  let data3 =
+    read_data_from_file ~biniou_reader:Clang_ast_b.read_source_location read_source_location name
+  in
+  Unix.unlink name ;
+  Utils.assert_equal (Printf.sprintf "test %s" name) data data3
+
+
+let biniou_files = List.map (( ^ ) "yojson_utils_test_tmpfile") [".biniou"; ".biniou.gz"]
+
+let test3 = List.iter biniou_test biniou_files
+
+let output_bytes oc len x =
+  for i = len - 1 downto 0 do output_byte oc ((x lsr (8 * i)) land 0xff) done
+
+
+let output_frame oc frame = output_bytes oc 4 (String.length frame) ; output_string oc frame
+
+let frames_test =
+  let name = "yojson_utils_test_tmpfile.frames" in
+  let frames = ["first"; ""; String.make 300 'x'] in
+  let oc = open_out_bin name in
+  List.iter (output_frame oc) frames ;
+  close_out oc ;
+  let read = ref [] in
+  iter_frames_from_file (fun frame -> read := frame :: !read) name ;
+  Unix.unlink name ;
+  Utils.assert_equal "test frames" frames (List.rev !read)
+
+let lazy_frames_test =
+  let name = "yojson_utils_test_tmpfile.lazy" in
+  let oc = open_out_bin name in
+  List.iter (output_frame oc) ["first"; "second"] ;
+  close_out oc ;
+  let decoded = ref [] in
+  let frames =
+    lazy_frames_from_file (fun frame -> decoded := frame :: !decoded ; String.length frame) name
+  in
+  Unix.unlink name ;
+  Utils.assert_equal "test lazy frames" [] !decoded ;
+  Utils.assert_equal "test lazy frame" 6 (Lazy.force frames.(1)) ;
+  Utils.assert_equal "test lazy frames decoded" ["second"] !decoded
+
+
+let frame_index_test =
+  let name = "yojson_utils_test_tmpfile.indexed" in
+  let oc = open_out_bin name in
+  output_frame oc "first" ;
+  output_frame oc "second" ;
+  let index_offset = pos_out oc in
+  let index = Buffer.create 64 in
+  let add_bytes len x =
+    for i = len - 1 downto 0 do Buffer.add_char index (Char.chr ((x lsr (8 * i)) land 0xff)) done
+  in
+  (* decls 1 and 3 in the first frame, decl 7 in the second one *)
+  add_bytes 4 3 ;
+  List.iter (fun (ptr, offset) -> add_bytes 8 ptr ; add_bytes 8 offset) [(1, 0); (3, 0); (7, 9)] ;
+  (* hash 18446744073709551615 (all bits set) in both frames *)
+  add_bytes 4 2 ;
+  List.iter
+    (fun offset -> Buffer.add_string index (String.make 8 '\255') ; add_bytes 8 offset)
+    [0; 9] ;
+  add_bytes 8 index_offset ;
+  Buffer.add_string index "ASTINDEX" ;
+  output_frame oc (Buffer.contents index) ;
+  close_out oc ;
+  let fi = open_frame_index name in
+  Utils.assert_equal "test decl frame" (Some "second") (find_decl_frame fi 7) ;
+  Utils.assert_equal "test decl frame" (Some "first") (find_decl_frame fi 3) ;
+  Utils.assert_equal "test missing decl frame" None (find_decl_frame fi 2) ;
+  Utils.assert_equal "test mangled name frames" ["first"; "second"]
+    (find_mangled_name_frames fi "18446744073709551615") ;
+  Utils.assert_equal "test missing mangled name frames" [] (find_mangled_name_frames fi "42") ;
+  close_frame_index fi ;
+  Unix.unlink name
+
+
+let decl_store_test =
+  let store = "yojson_utils_test_tmpstore" in
+  let digest = "0123456789abcdef0123456789abcdef" in
+  Unix.mkdir store 0o755 ;
+  let oc = open_out_bin (Filename.concat store digest) in
+  output_string oc "stored" ;
+  close_out oc ;
+  let name = "yojson_utils_test_tmpfile.stored" in
+  let oc = open_out_bin name in
+  output_frame oc "first" ;
+  output_frame oc ("ASTSTORE" ^ digest) ;
+  let index_offset = pos_out oc in
+  let index = Buffer.create 64 in
+  let add_bytes len x =
+    for i = len - 1 downto 0 do Buffer.add_char index (Char.chr ((x lsr (8 * i)) land 0xff)) done
+  in
+  (* decl 5 in the stored frame *)
+  add_bytes 4 1 ;
+  add_bytes 8 5 ;
+  add_bytes 8 9 ;
+  add_bytes 4 0 ;
+  add_bytes 8 index_offset ;
+  Buffer.add_string index "ASTINDEX" ;
+  output_frame oc (Buffer.contents index) ;
+  close_out oc ;
+  let read = ref [] in
+  iter_frames_from_file ~decl_store:store (fun frame -> read := frame :: !read) name ;
+  Utils.assert_equal "test stored frames" ["first"; "stored"; Buffer.contents index]
+    (List.rev !read) ;
+  let frames = lazy_frames_from_file ~decl_store:store (fun frame -> frame) name in
+  Utils.assert_equal "test lazy stored frame" "stored" (Lazy.force frames.(1)) ;
+  let fi = open_frame_index ~decl_store:store name in
+  Utils.assert_equal "test stored decl frame" (Some "stored") (find_decl_frame fi 5) ;
+  close_frame_index fi ;
+  let fi = open_frame_index name in
+  Utils.assert_equal "test unresolved decl frame" (Some ("ASTSTORE" ^ digest))
+    (find_decl_frame fi 5) ;
+  close_frame_index fi ;
+  Unix.unlink name ;
+  Unix.unlink (Filename.concat store digest) ;
+  Unix.rmdir store
+
+
+let interned_strings_test =
+  let json =
+    "[\"/path/to/file.h\",\"short\",\"\\u0001\\u0001marked string\",\"\\u00010\",\"\\u00011\"]\n"
+    ^ "[\"/path/to/file.h\",\"\\u00010\"]"
+  in
+  Utils.assert_equal "test interned strings json"
+    ( "[\"/path/to/file.h\",\"short\",\"\\u0001marked string\",\"/path/to/file.h\","
+    ^ "\"\\u0001marked string\"]\n[\"/path/to/file.h\",\"/path/to/file.h\"]\n" )
+    (expand_interned_strings ~biniou:false json) ;
+  (* constructors are numbered in standard JSON, not in Yojson *)
+  let json =
+    "[[\"VariantWithArg\",\"/path/to/file.h\"],\"SimpleVariant\",\"\\u00010\",\"\\u00011\","
+    ^ "\"\\u00012\"]"
+  in
+  Utils.assert_equal "test interned strings json variants"
+    ( "[[\"VariantWithArg\",\"/path/to/file.h\"],\"SimpleVariant\",\"VariantWithArg\","
+    ^ "\"/path/to/file.h\",\"SimpleVariant\"]\n" )
+    (expand_interned_strings ~biniou:false json) ;
+  let yojson =
+    "[<\"VariantWithArg\":\"/path/to/file.h\">,<\"SimpleVariant\">,\"/path/to/other/file.h\","
+    ^ "\"\\u00010\",\"\\u00011\"]"
+  in
+  Utils.assert_equal "test interned strings yojson variants"
+    ( "[<\"VariantWithArg\":\"/path/to/file.h\">,<\"SimpleVariant\">,\"/path/to/other/file.h\","
+    ^ "\"/path/to/file.h\",\"/path/to/other/file.h\"]\n" )
+    (expand_interned_strings ~biniou:false yojson) ;
+  let biniou = Bi_io.string_of_tree (`Tuple [|`String "/path/to/file.h"; `String "\0010"|]) in
+  Utils.assert_equal "test interned strings biniou"
+    (`Tuple [|`String "/path/to/file.h"; `String "/path/to/file.h"|])
+    (Bi_io.tree_of_string (expand_interned_strings ~biniou:true biniou))
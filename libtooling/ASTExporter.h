@@ -28,7 +28,10 @@
  */
 
 #pragma once
+#include <algorithm>
+#include <fnmatch.h>
 #include <memory>
+#include <vector>
 
 #include <clang/AST/ASTConsumer.h>
 #include <clang/AST/ASTContext.h>
@@ -49,10 +52,22 @@
 #include <clang/Frontend/FrontendDiagnostic.h>
 #include <clang/Frontend/FrontendPluginRegistry.h>
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Regex.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include "AsyncOutputStream.h"
 #include "AttrParameterVectorStream.h"
+#include "DeclStore.h"
+#include "ExportCache.h"
+#include "ExporterStats.h"
+#include "FramedOutputStream.h"
+#include "GzipOutputStream.h"
 #include "NamePrinter.h"
+#include "PresumedLocCache.h"
 #include "SimplePluginASTAction.h"
 #include "atdlib/ATDWriter.h"
 
@@ -66,17 +81,99 @@ struct ASTExporterOptions : ASTPluginLib::PluginASTOptionsBase {
   bool withPointers = true;
   bool dumpComments = false;
   bool useMacroExpansionLocation = true;
+  bool compactSourceLocations = false;
+  bool dedupDeclRefs = false;
+  // only dump the bodies of the code of the main file, see isPrunedDecl
+  bool mainFileOnly = false;
+  // do not dump the bodies of functions, methods and blocks
+  bool declsOnly = false;
+  // do not dump the members and the bodies of implicit template
+  // instantiations, see isElidedInstantiation
+  bool elideTemplateInstantiations = false;
+  // do not dump the children of statements nested deeper, unlimited if 0
+  unsigned long maxStmtDepth = 0;
+  // dump the length and the hash of the string literals longer than this
+  // instead of their bytes, disabled if 0, see VisitStringLiteral
+  unsigned long stringLiteralHashThreshold = 0;
+  // only dump the types referred to by the rest of the output
+  bool referencedTypesOnly = false;
+  // one frame per top-level decl, see dumpFramedTranslationUnit
+  bool framedOutput = false;
+  // with framedOutput, end with an index of the frames, see dumpFrameIndex
+  bool writeIndex = false;
+  // directory of previous exports to reuse, disabled if empty
+  std::string exportCacheDir;
+  // with framedOutput, directory of the frames shared with the outputs of
+  // other translation units, disabled if empty, see DeclStore
+  std::string declStoreDir;
+  // only dump the top-level decls whose normalized path matches one of these
+  // ':'-separated globs and whose qualified name matches this regex, see
+  // isFilteredOutDecl
+  std::string declPathFilter;
+  std::string declNameFilter;
+  // check the sizes of the tuples, objects and lists written, which cost a
+  // few instructions per value, see reportSizeError
+  bool checkSizes = false;
+  // compress and write the output on a thread of its own, see
+  // AsyncOutputStream
+  bool asyncOutput = false;
+  // write counters of the export next to the output, see ExporterStats.
+  // Exports replayed from the cache have no counters.
+  bool stats = false;
   ATDWriter::ATDWriterOptions atdWriterOptions = {
       .useYojson = false,
       .prettifyJson = true,
+      .streamContainers = false,
+      .internStrings = false,
   };
 
   void loadValuesFromEnvAndMap(
       const ASTPluginLib::PluginASTOptionsBase::argmap_t &map) {
     ASTPluginLib::PluginASTOptionsBase::loadValuesFromEnvAndMap(map);
     loadBool(map, "AST_WITH_POINTERS", withPointers);
+    loadBool(map, "COMPACT_SOURCE_LOCATIONS", compactSourceLocations);
+    loadBool(map, "DEDUP_DECL_REFS", dedupDeclRefs);
+    loadBool(map, "MAIN_FILE_ONLY", mainFileOnly);
+    loadBool(map, "DECLS_ONLY", declsOnly);
+    loadBool(
+        map, "ELIDE_TEMPLATE_INSTANTIATIONS", elideTemplateInstantiations);
+    loadUnsignedInt(map, "MAX_STMT_DEPTH", maxStmtDepth);
+    loadUnsignedInt(
+        map, "STRING_LITERAL_HASH_THRESHOLD", stringLiteralHashThreshold);
+    loadBool(map, "REFERENCED_TYPES_ONLY", referencedTypesOnly);
+    loadBool(map, "FRAMED_OUTPUT", framedOutput);
+    loadBool(map, "WRITE_INDEX", writeIndex);
+    loadString(map, "EXPORT_CACHE_DIR", exportCacheDir);
+    loadString(map, "DECL_STORE_DIR", declStoreDir);
+    loadString(map, "DECL_PATH_FILTER", declPathFilter);
+    loadString(map, "DECL_NAME_FILTER", declNameFilter);
+    loadBool(map, "CHECK_SIZES", checkSizes);
+    loadBool(map, "ASYNC_OUTPUT", asyncOutput);
+    loadBool(map, "AST_EXPORTER_STATS", stats);
     loadBool(map, "USE_YOJSON", atdWriterOptions.useYojson);
     loadBool(map, "PRETTIFY_JSON", atdWriterOptions.prettifyJson);
+    loadBool(map, "STREAM_CONTAINERS", atdWriterOptions.streamContainers);
+    loadBool(map, "INTERN_STRINGS", atdWriterOptions.internStrings);
+  }
+
+  // Options that the output depends on, for ExportCache
+  std::string cacheKey() const {
+    std::string key;
+    llvm::raw_string_ostream OS(key);
+    OS << basePath << '\0' << repoRoot << '\0' << iSysRoot << '\0'
+       << allowSiblingsToRepoRoot << keepExternalPaths << resolveSymlinks << ' '
+       << maxStringSize << ' ' << withPointers << dumpComments
+       << useMacroExpansionLocation << compactSourceLocations << dedupDeclRefs
+       << mainFileOnly << declsOnly << elideTemplateInstantiations << ' '
+       << maxStmtDepth << ' '
+       << stringLiteralHashThreshold << ' '
+       << referencedTypesOnly << framedOutput << writeIndex
+       << declStoreDir << '\0'
+       << declPathFilter << '\0' << declNameFilter << '\0'
+       << atdWriterOptions.useYojson << atdWriterOptions.prettifyJson
+       << atdWriterOptions.streamContainers
+       << atdWriterOptions.internStrings;
+    return OS.str();
   }
 };
 
@@ -199,6 +296,7 @@ class ASTExporter : public ConstDeclVisitor<ASTExporter<ATDWriter>>,
   typedef typename ATDWriter::ArrayScope ArrayScope;
   typedef typename ATDWriter::TupleScope TupleScope;
   typedef typename ATDWriter::VariantScope VariantScope;
+  typedef typename ATDWriter::Tag Tag;
   ATDWriter OF;
 
   ASTContext &Context;
@@ -223,15 +321,83 @@ class ASTExporter : public ConstDeclVisitor<ASTExporter<ATDWriter>>,
   const char *LastLocFilename;
   unsigned LastLocLine;
 
+  // With compact source locations, files are referred to by their index in
+  // the table emitted with the translation unit, and columns are deltas.
+  llvm::DenseMap<const char *, int> FileIndexByName;
+  llvm::StringMap<int> FileIndexByPath;
+  std::vector<std::string> SourceFiles;
+  int LastLocFileIndex;
+  unsigned LastLocColumn;
+
+  // With FRAMED_OUTPUT, whether the state above is reset with each frame,
+  // see beginFrame
+  bool SelfContainedFrames;
+
   // The \c FullComment parent of the comment being dumped.
   const FullComment *FC;
 
+  PresumedLocCache LocCache;
+
   NamePrinter<ATDWriter> NamePrint;
 
+  // Numbering of the AST nodes, in the order they are referred to
+  llvm::DenseMap<const void *, int64_t> PointerMap;
+
+  // With DECL_STORE_DIR, the nodes first referred to in a top-level frame are
+  // numbered after the decl of the frame, see beginFramePointerIds. Zero
+  // otherwise.
+  uint64_t FramePointerIdBase;
+  uint64_t FramePointerIdCount;
+  llvm::DenseSet<uint64_t> FramePointerIdHashes;
+
+  // Whether the decls of the translation unit are dumped in frames of their
+  // own rather than in its decl context
+  bool FramedTopLevelDecls;
+
+  // With WRITE_INDEX, the stream to index and the offsets of the frames
+  // holding each decl and each mangled name hash
+  FramedOutputStream *IndexedFrames;
+  std::vector<std::pair<uint64_t, uint64_t>> DeclFrames;
+  std::vector<std::pair<uint64_t, uint64_t>> MangledNameFrames;
+
+  // Decls whose name and type were already emitted by dumpDeclRef
+  llvm::DenseSet<const Decl *> DumpedDeclRefs;
+
+  // With REFERENCED_TYPES_ONLY, the types to dump with the translation unit,
+  // in the order they were first referred to
+  llvm::SetVector<const Type *> ReferencedTypes;
+
+  // Number of statements being dumped, see MAX_STMT_DEPTH
+  unsigned StmtDepth;
+
+  // Hashes of the mangled names, each decl is mangled once
+  llvm::DenseMap<const Decl *, uint64_t> MangledNameHashes;
+
+  // Printed DeclarationNames that are not identifiers (operators, selectors,
+  // constructors...), each name is printed once, see getDeclNameString
+  llvm::DenseMap<void *, std::string> DeclNameStrings;
+
+  // Compiled DECL_PATH_FILTER and DECL_NAME_FILTER
+  bool HasDeclFilter;
+  std::vector<std::string> DeclPathGlobs;
+  bool HasDeclNameRegex;
+  llvm::Regex DeclNameRegex;
+
+  // Scratch storage reused from one node to the next, so that dumping a
+  // node does not allocate once the buffers have grown.
+  // Lists of decls are pushed on DeclStack by the enclosing nodes and popped
+  // once dumped, see dumpDeclStack.
+  SmallVector<const Decl *, 256> DeclStack;
+  std::string NameBuffer;
+
+  // With AST_EXPORTER_STATS, the counters to fill in, otherwise null
+  ExporterStats *Stats;
+
  public:
   ASTExporter(raw_ostream &OS,
               ASTContext &Context,
-              const ASTExporterOptions &Opts)
+              const ASTExporterOptions &Opts,
+              ExporterStats *Stats = nullptr)
       : OF(OS, Opts.atdWriterOptions),
         Context(Context),
         Options(Opts),
@@ -244,11 +410,38 @@ class ASTExporter : public ConstDeclVisitor<ASTExporter<ATDWriter>>,
             Comment::NoCommentKind, SourceLocation(), SourceLocation())),
         LastLocFilename(""),
         LastLocLine(~0U),
+        LastLocFileIndex(-1),
+        LastLocColumn(~0U),
+        SelfContainedFrames(false),
         FC(0),
-        NamePrint(Context.getSourceManager(), OF) {}
+        LocCache(Context.getSourceManager(), Opts),
+        NamePrint(LocCache, OF),
+        FramePointerIdBase(0),
+        FramePointerIdCount(0),
+        FramedTopLevelDecls(false),
+        IndexedFrames(nullptr),
+        StmtDepth(0),
+        Stats(Stats) {
+    // rough estimate of the number of nodes, to avoid rehashing. Large
+    // allocations such as those of PCHs or of huge literals inflate it, hence
+    // the cap (about 16MB of buckets) beyond which the map grows as usual.
+    PointerMap.reserve(
+        std::min<size_t>(Context.getASTAllocatedMemory() / 64, 1 << 19));
+    compileDeclFilter();
+    if (Opts.checkSizes) {
+      OF.enableSizeChecks();
+    }
+  }
 
   void dumpDecl(const Decl *D);
+  void dumpDeclStack(size_t Start);
+  void dumpFramedTranslationUnit(FramedOutputStream &Frames,
+                                 DeclStore *Store = nullptr);
+  void dumpFrameIndex(FramedOutputStream &Frames);
+  void beginFrame();
+  bool reportSizeError();
   void dumpStmt(const Stmt *S);
+  bool dumpStmtHead(const Stmt *S);
   void dumpFullComment(const FullComment *C);
   void dumpType(const Type *T);
   void dumpPointerToType(const Type *T);
@@ -256,21 +449,41 @@ class ASTExporter : public ConstDeclVisitor<ASTExporter<ATDWriter>>,
   void dumpClassLambdaCapture(const LambdaCapture *C);
   void dumpVersionTuple(const VersionTuple &VT);
 
+  // Variant tags of AST nodes, hashed at compile time
+  static const Tag &declKindTag(Decl::Kind Kind);
+  static const Tag &stmtClassTag(Stmt::StmtClass Class);
+  static const Tag &commentKindTag(Comment::CommentKind Kind);
+  static const Tag &typeClassTag(const Type *T);
+  static const Tag &attrKindTag(attr::Kind Kind);
+
   // Utilities
+  int64_t getPointerId(const void *Ptr);
+  void beginFramePointerIds(const Decl *D);
+  void nextFramePointerIdBase(uint64_t Hash);
   void dumpPointer(const void *Ptr);
   void dumpSourceRange(SourceRange R);
   void dumpSourceLocation(SourceLocation Loc);
+  void dumpCompactSourceLocation(const PresumedLoc &PLoc);
+  int getFileIndex(const char *Filename);
   void dumpQualType(const QualType &qt);
   void dumpTypeOld(const Type *T);
   void dumpDeclRef(const Decl &Node);
+  void dumpMangledNameHash(const NamedDecl *D);
   bool hasNodes(const DeclContext *DC);
   void dumpLookups(const DeclContext &DC);
   void dumpSelector(const Selector sel);
   void dumpName(const NamedDecl &decl);
+  StringRef getDeclNameString(DeclarationName Name);
   void dumpInputKind(const InputKind kind);
   void dumpIntegerTypeWidths(const TargetInfo &info);
 
   bool alwaysEmitParent(const Decl *D);
+  bool isInMainFile(const Decl *D);
+  void compileDeclFilter();
+  bool isFilteredOutDecl(const Decl *D);
+  bool isPrunedDecl(const Decl *D);
+  bool shouldDumpBody(const Decl *D);
+  bool isElidedInstantiation(const Decl *D);
 
   void emitAPInt(bool isSigned, const llvm::APInt &value);
 
@@ -521,25 +734,74 @@ bool hasMeaningfulTypeInfo(const Type *T) {
          T->isConstantSizeType();
 }
 
-std::unordered_map<const void *, int> pointerMap;
-int pointerCounter = 1;
+// With DECL_STORE_DIR, the frames of a header are only shared by the outputs
+// of several translation units if they are identical, pointers included. The
+// pointers first referred to in the frame of a top-level decl are thus
+// numbered after what identifies the decl across translation units: its kind,
+// its name and its location. Their ids have bit 61 set, then 37 bits of hash
+// of the decl and 24 bits of rank in the frame, so that they fit in OCaml
+// ints and never collide with the ids numbered in order, which are smaller.
+// Decls with the same hash take the next free one.
+static const unsigned FRAME_POINTER_ID_COUNT_BITS = 24;
+static const uint64_t FRAME_POINTER_ID_COUNT_MASK =
+    (1ULL << FRAME_POINTER_ID_COUNT_BITS) - 1;
+static const uint64_t FRAME_POINTER_ID_HASH_MASK = (1ULL << 37) - 1;
+static const uint64_t FRAME_POINTER_ID_FLAG = 1ULL << 61;
 
 //@atd type pointer = int
 template <class ATDWriter>
-void writePointer(ATDWriter &OF, bool withPointers, const void *Ptr) {
+int64_t ASTExporter<ATDWriter>::getPointerId(const void *Ptr) {
   if (!Ptr) {
-    OF.emitInteger(0);
-    return;
+    return 0;
   }
-  if (pointerMap.find(Ptr) == pointerMap.end()) {
-    pointerMap[Ptr] = pointerCounter++;
+  auto Inserted = PointerMap.try_emplace(Ptr, 0);
+  if (Inserted.second) {
+    if (!FramePointerIdBase) {
+      // pointers are numbered from 1 in the order they are first seen
+      Inserted.first->second = PointerMap.size();
+    } else {
+      if (FramePointerIdCount == FRAME_POINTER_ID_COUNT_MASK) {
+        nextFramePointerIdBase(FramePointerIdBase >>
+                               FRAME_POINTER_ID_COUNT_BITS);
+      }
+      Inserted.first->second = FramePointerIdBase | ++FramePointerIdCount;
+    }
   }
-  OF.emitInteger(pointerMap[Ptr]);
+  return Inserted.first->second;
+}
+
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::beginFramePointerIds(const Decl *D) {
+  std::string Key = D->getDeclKindName();
+  if (const auto *ND = dyn_cast<NamedDecl>(D)) {
+    Key += ' ';
+    Key += ND->getNameAsString();
+  }
+  PresumedLoc PLoc = LocCache.getPresumedLoc(
+      Context.getSourceManager().getExpansionLoc(D->getLocation()));
+  if (PLoc.isValid()) {
+    Key += ' ';
+    Key += LocCache.getNormalizedPath(PLoc);
+    Key += ':' + std::to_string(PLoc.getLine()) + ':' +
+           std::to_string(PLoc.getColumn());
+  }
+  nextFramePointerIdBase(fnv64Hash(Key.data(), Key.size()));
+}
+
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::nextFramePointerIdBase(uint64_t Hash) {
+  Hash &= FRAME_POINTER_ID_HASH_MASK;
+  while (!Hash || !FramePointerIdHashes.insert(Hash).second) {
+    Hash = (Hash + 1) & FRAME_POINTER_ID_HASH_MASK;
+  }
+  FramePointerIdBase =
+      FRAME_POINTER_ID_FLAG | Hash << FRAME_POINTER_ID_COUNT_BITS;
+  FramePointerIdCount = 0;
 }
 
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpPointer(const void *Ptr) {
-  writePointer(OF, Options.withPointers, Ptr);
+  OF.emitInteger(getPointerId(Ptr));
 }
 
 //@atd type source_file = string
@@ -547,29 +809,40 @@ void ASTExporter<ATDWriter>::dumpPointer(const void *Ptr) {
 //@atd   ?file <ocaml mutable> : source_file option;
 //@atd   ?line <ocaml mutable> : int option;
 //@atd   ?column <ocaml mutable> : int option;
+//@atd   ?file_index <ocaml mutable> : int option;
+//@atd   ?column_delta <ocaml mutable> : int option;
 //@atd } <ocaml field_prefix="sl_" validator="Clang_ast_visit.visit_source_loc">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpSourceLocation(SourceLocation Loc) {
-  const SourceManager &SM = Context.getSourceManager();
-  SourceLocation ExpLoc =
-      Options.useMacroExpansionLocation ? SM.getExpansionLoc(Loc) : Loc;
-  SourceLocation SpellingLoc = SM.getSpellingLoc(ExpLoc);
+  PresumedLoc PLoc;
+  {
+    ExporterStats::Timer Timer(Stats, ExporterStats::SourceLocations);
+    const SourceManager &SM = Context.getSourceManager();
+    SourceLocation ExpLoc =
+        Options.useMacroExpansionLocation ? SM.getExpansionLoc(Loc) : Loc;
+    SourceLocation SpellingLoc = SM.getSpellingLoc(ExpLoc);
+    PLoc = LocCache.getPresumedLoc(SpellingLoc);
+  }
 
   // The general format we print out is filename:line:col, but we drop pieces
   // that haven't changed since the last loc printed.
-  PresumedLoc PLoc = SM.getPresumedLoc(SpellingLoc);
 
   if (PLoc.isInvalid()) {
     ObjectScope Scope(OF, 0);
     return;
   }
 
+  if (Options.compactSourceLocations) {
+    dumpCompactSourceLocation(PLoc);
+    return;
+  }
+
   if (strcmp(PLoc.getFilename(), LastLocFilename) != 0) {
     ObjectScope Scope(OF, 3);
     OF.emitTag("file");
     // Normalizing filenames matters because the current directory may change
     // during the compilation of large projects.
-    OF.emitString(Options.normalizeSourcePath(PLoc.getFilename()));
+    OF.emitString(LocCache.getNormalizedPath(PLoc));
     OF.emitTag("line");
     OF.emitInteger(PLoc.getLine());
     OF.emitTag("column");
@@ -587,7 +860,70 @@ void ASTExporter<ATDWriter>::dumpSourceLocation(SourceLocation Loc) {
   }
   LastLocFilename = PLoc.getFilename();
   LastLocLine = PLoc.getLine();
-  // TODO: lastLocColumn
+}
+
+template <class ATDWriter>
+int ASTExporter<ATDWriter>::getFileIndex(const char *Filename) {
+  // Filenames of presumed locations are shared by all the locations of a
+  // file, so looking up the pointer first avoids comparing strings.
+  auto I = FileIndexByName.find(Filename);
+  if (I != FileIndexByName.end()) {
+    return I->second;
+  }
+  // Normalizing filenames matters because the current directory may change
+  // during the compilation of large projects.
+  std::string Path = Options.normalizeSourcePath(Filename);
+  auto Inserted = FileIndexByPath.try_emplace(Path, SourceFiles.size());
+  if (Inserted.second) {
+    SourceFiles.push_back(std::move(Path));
+  }
+  int Index = Inserted.first->second;
+  FileIndexByName[Filename] = Index;
+  return Index;
+}
+
+// Same as dumpSourceLocation but a new file is given by its index in
+// source_files (see translation_unit_decl_info), a column on the same line is
+// given as a delta, and a location identical to the previous one is empty.
+// With FRAMED_OUTPUT, the table is local to each frame instead, and a file is
+// given by its name along with its index the first time it is referred to in
+// the frame.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpCompactSourceLocation(
+    const PresumedLoc &PLoc) {
+  size_t NumFiles = SourceFiles.size();
+  int FileIndex = getFileIndex(PLoc.getFilename());
+  bool DumpFile = SelfContainedFrames && SourceFiles.size() != NumFiles;
+  unsigned Line = PLoc.getLine();
+  unsigned Column = PLoc.getColumn();
+  if (FileIndex != LastLocFileIndex) {
+    ObjectScope Scope(OF, 3 + DumpFile);
+    if (DumpFile) {
+      OF.emitTag("file");
+      OF.emitString(SourceFiles[FileIndex]);
+    }
+    OF.emitTag("file_index");
+    OF.emitInteger(FileIndex);
+    OF.emitTag("line");
+    OF.emitInteger(Line);
+    OF.emitTag("column");
+    OF.emitInteger(Column);
+  } else if (Line != LastLocLine) {
+    ObjectScope Scope(OF, 2);
+    OF.emitTag("line");
+    OF.emitInteger(Line);
+    OF.emitTag("column");
+    OF.emitInteger(Column);
+  } else if (Column != LastLocColumn) {
+    ObjectScope Scope(OF, 1);
+    OF.emitTag("column_delta");
+    OF.emitInteger((int64_t)Column - LastLocColumn);
+  } else {
+    ObjectScope Scope(OF, 0);
+  }
+  LastLocFileIndex = FileIndex;
+  LastLocLine = Line;
+  LastLocColumn = Column;
 }
 
 //@atd type source_range = (source_location * source_location)
@@ -630,26 +966,52 @@ void ASTExporter<ATDWriter>::dumpName(const NamedDecl &Decl) {
 
   OF.emitTag("name");
 
-  std::string name = Decl.getNameAsString();
-  if (name.length() == 0) {
+  StringRef Name = getDeclNameString(Decl.getDeclName());
+  if (Name.empty()) {
     const FieldDecl *FD = dyn_cast<FieldDecl>(&Decl);
     if (FD) {
-      name = "__anon_field_" + std::to_string(FD->getFieldIndex());
+      NameBuffer.clear();
+      llvm::raw_string_ostream NameOS(NameBuffer);
+      NameOS << "__anon_field_" << FD->getFieldIndex();
+      Name = NameOS.str();
     }
   }
-  OF.emitString(name);
+  OF.emitString(Name);
 
   OF.emitTag("qual_name");
+  ExporterStats::Timer Timer(Stats, ExporterStats::NamePrinting);
   NamePrint.printDeclName(Decl);
 }
 
+// Same as Name.getAsString(). Identifiers are not copied, the other names are
+// printed once. The result is only valid until the next call.
+template <class ATDWriter>
+StringRef ASTExporter<ATDWriter>::getDeclNameString(DeclarationName Name) {
+  if (const IdentifierInfo *II = Name.getAsIdentifierInfo()) {
+    return StringRef(II->getNameStart(), II->getLength());
+  }
+  if (Name.isEmpty()) {
+    return StringRef();
+  }
+  auto Inserted = DeclNameStrings.try_emplace(Name.getAsOpaquePtr());
+  std::string &Str = Inserted.first->second;
+  if (Inserted.second) {
+    llvm::raw_string_ostream OS(Str);
+    OS << Name;
+  }
+  return Str;
+}
+
+// With DEDUP_DECL_REFS, only the first reference to a declaration carries
+// its name and type. Clang_ast_main.index_node_pointers fills them in the
+// later references.
 //@atd type decl_ref = {
 //@atd   kind : decl_kind;
 //@atd   decl_pointer : pointer;
-//@atd   ?name : named_decl_info option;
+//@atd   ?name <ocaml mutable> : named_decl_info option;
 //@atd   ~is_hidden : bool;
-//@atd   ?qual_type : qual_type option
-//@atd } <ocaml field_prefix="dr_">
+//@atd   ?qual_type <ocaml mutable> : qual_type option
+//@atd } <ocaml field_prefix="dr_" validator="Clang_ast_visit.visit_decl_ref">
 //@atd type decl_kind = [
 #define DECL(DERIVED, BASE) //@atd | DERIVED
 #define ABSTRACT_DECL(DECL) DECL
@@ -660,23 +1022,49 @@ void ASTExporter<ATDWriter>::dumpDeclRef(const Decl &D) {
   const NamedDecl *ND = dyn_cast<NamedDecl>(&D);
   const ValueDecl *VD = dyn_cast<ValueDecl>(&D);
   bool IsHidden = ND && ND->isHidden();
-  ObjectScope Scope(OF, 2 + (bool)ND + (bool)VD + IsHidden);
+  bool IsRepeated = Options.dedupDeclRefs && !DumpedDeclRefs.insert(&D).second;
+  bool DumpName = ND && !IsRepeated;
+  bool DumpType = VD && !IsRepeated;
+  ObjectScope Scope(OF, 2 + DumpName + DumpType + IsHidden);
 
   OF.emitTag("kind");
   OF.emitSimpleVariant(D.getDeclKindName());
   OF.emitTag("decl_pointer");
   dumpPointer(&D);
-  if (ND) {
+  if (DumpName) {
     OF.emitTag("name");
     dumpName(*ND);
-    OF.emitFlag("is_hidden", IsHidden);
   }
-  if (VD) {
+  OF.emitFlag("is_hidden", IsHidden);
+  if (DumpType) {
     OF.emitTag("qual_type");
     dumpQualType(VD->getType());
   }
 }
 
+// mangled names can get ridiculously long, so hash them to a fixed size
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpMangledNameHash(const NamedDecl *D) {
+  auto Inserted = MangledNameHashes.try_emplace(D, 0);
+  uint64_t &Hash = Inserted.first->second;
+  if (Inserted.second) {
+    ExporterStats::Timer Timer(Stats, ExporterStats::Mangling);
+    FNV64HashStream HashOS;
+    if (const auto *CD = dyn_cast<CXXConstructorDecl>(D)) {
+      Mangler->mangleCXXCtor(CD, Ctor_Complete, HashOS);
+    } else if (const auto *DD = dyn_cast<CXXDestructorDecl>(D)) {
+      Mangler->mangleCXXDtor(DD, Dtor_Deleting, HashOS);
+    } else {
+      Mangler->mangleName(D, HashOS);
+    }
+    Hash = HashOS.hash();
+  }
+  if (IndexedFrames) {
+    MangledNameFrames.emplace_back(Hash, IndexedFrames->frameOffset());
+  }
+  OF.emitString(std::to_string(Hash));
+}
+
 template <class ATDWriter>
 int ASTExporter<ATDWriter>::DeclContextTupleSize() {
   return 2;
@@ -684,7 +1072,8 @@ int ASTExporter<ATDWriter>::DeclContextTupleSize() {
 //@atd #define decl_context_tuple decl list * decl_context_info
 //@atd type decl_context_info = {
 //@atd   ~has_external_lexical_storage : bool;
-//@atd   ~has_external_visible_storage : bool
+//@atd   ~has_external_visible_storage : bool;
+//@atd   ~has_elided_decls : bool
 //@atd } <ocaml field_prefix="dci_">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitDeclContext(const DeclContext *DC) {
@@ -695,34 +1084,60 @@ void ASTExporter<ATDWriter>::VisitDeclContext(const DeclContext *DC) {
     { ObjectScope Scope(OF, 0); }
     return;
   }
-  {
-    std::vector<Decl *> declsToDump;
+  /* Some typedefs are not part of AST. 'instancetype' is one of them.
+  Export it nevertheless as part of TranslationUnitDecl context. */
+  // getObjCInstanceType() should return null type when 'instancetype' is not
+  // known yet - it doesn't work this way due to bug in clang, but keep
+  // the check for when the bug is fixed.
+  bool DumpInstanceType = isa<TranslationUnitDecl>(DC) &&
+                          Context.getObjCInstanceType().getTypePtrOrNull();
+  bool MayPrune = (Options.mainFileOnly || HasDeclFilter) &&
+                  (isa<TranslationUnitDecl>(DC) || isa<NamespaceDecl>(DC) ||
+                   isa<LinkageSpecDecl>(DC));
+  bool HasElidedDecls = isElidedInstantiation(cast<Decl>(DC));
+  if (FramedTopLevelDecls && isa<TranslationUnitDecl>(DC)) {
+    // already dumped by dumpFramedTranslationUnit
+    ArrayScope Scope(OF, 0);
+  } else if (HasElidedDecls) {
+    ArrayScope Scope(OF, 0);
+  } else if (Options.atdWriterOptions.streamContainers &&
+             !isa<TranslationUnitDecl>(DC) && !isa<NamespaceDecl>(DC) &&
+             !isa<LinkageSpecDecl>(DC)) {
+    // the size of the list is filled in by the writer, which keeps the
+    // output buffered until then: file-level contexts, whose lists hold most
+    // of the output, are sized up front below
+    ArrayScope Scope(OF);
     for (auto I : DC->decls()) {
-      declsToDump.push_back(I);
+      if (!MayPrune || !isPrunedDecl(I)) {
+        dumpDecl(I);
+      }
     }
-    /* Some typedefs are not part of AST. 'instancetype' is one of them.
-    Export it nevertheless as part of TranslationUnitDecl context. */
-    // getObjCInstanceType() should return null type when 'instancetype' is not
-    // known yet - it doesn't work this way due to bug in clang, but keep
-    // the check for when the bug is fixed.
-    if (isa<TranslationUnitDecl>(DC) &&
-        Context.getObjCInstanceType().getTypePtrOrNull()) {
-      declsToDump.push_back(Context.getObjCInstanceTypeDecl());
+    if (DumpInstanceType) {
+      dumpDecl(Context.getObjCInstanceTypeDecl());
     }
-    ArrayScope Scope(OF, declsToDump.size());
-    for (auto I : declsToDump) {
-      dumpDecl(I);
+  } else {
+    size_t Start = DeclStack.size();
+    for (auto I : DC->decls()) {
+      if (!MayPrune || !isPrunedDecl(I)) {
+        DeclStack.push_back(I);
+      }
+    }
+    if (DumpInstanceType) {
+      DeclStack.push_back(Context.getObjCInstanceTypeDecl());
     }
+    dumpDeclStack(Start);
   }
   {
     bool HasExternalLexicalStorage = DC->hasExternalLexicalStorage();
     bool HasExternalVisibleStorage = DC->hasExternalVisibleStorage();
     ObjectScope Scope(OF,
                       0 + HasExternalLexicalStorage +
-                          HasExternalVisibleStorage); // not covered by tests
+                          HasExternalVisibleStorage +
+                          HasElidedDecls); // not covered by tests
 
     OF.emitFlag("has_external_lexical_storage", HasExternalLexicalStorage);
     OF.emitFlag("has_external_visible_storage", HasExternalVisibleStorage);
+    OF.emitFlag("has_elided_decls", HasElidedDecls);
   }
 }
 
@@ -760,7 +1175,7 @@ void ASTExporter<ATDWriter>::dumpLookups(const DeclContext &DC) {
 
       ObjectScope Scope(OF, 2); // not covered by tests
       OF.emitTag("decl_name");
-      OF.emitString(Name.getAsString());
+      OF.emitString(getDeclNameString(Name));
 
       OF.emitTag("decl_refs");
       {
@@ -1052,6 +1467,130 @@ bool ASTExporter<ATDWriter>::alwaysEmitParent(const Decl *D) {
   }
   return false;
 }
+
+template <class ATDWriter>
+bool ASTExporter<ATDWriter>::isInMainFile(const Decl *D) {
+  const SourceManager &SM = Context.getSourceManager();
+  return SM.isWrittenInMainFile(SM.getExpansionLoc(D->getLocation()));
+}
+
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::compileDeclFilter() {
+  HasDeclFilter = false;
+  HasDeclNameRegex = false;
+  SmallVector<StringRef, 4> Globs;
+  StringRef(Options.declPathFilter).split(Globs, ':', -1, false);
+  // matched with fnmatch rather than llvm::GlobPattern, which a statically
+  // linked clang may not export to plugins
+  for (StringRef Glob : Globs) {
+    DeclPathGlobs.push_back(Glob.str());
+    HasDeclFilter = true;
+  }
+  if (!Options.declNameFilter.empty()) {
+    DeclNameRegex = llvm::Regex(Options.declNameFilter);
+    std::string Error;
+    if (DeclNameRegex.isValid(Error)) {
+      HasDeclNameRegex = true;
+      HasDeclFilter = true;
+    } else {
+      llvm::errs() << "Ignoring invalid DECL_NAME_FILTER regex "
+                   << Options.declNameFilter << ": " << Error << "\n";
+    }
+  }
+}
+
+// With DECL_PATH_FILTER or DECL_NAME_FILTER, the top-level decls that are
+// declared in other files or have other names are left out, even if they are
+// referenced. Namespaces and linkage specs are kept, their decls are filtered.
+template <class ATDWriter>
+bool ASTExporter<ATDWriter>::isFilteredOutDecl(const Decl *D) {
+  if (!HasDeclFilter) {
+    return false;
+  }
+  // unlike the contexts of unscoped enums, which are transparent too
+  if (isa<NamespaceDecl>(D) || isa<LinkageSpecDecl>(D)) {
+    return false;
+  }
+  if (!DeclPathGlobs.empty()) {
+    PresumedLoc PLoc = LocCache.getPresumedLoc(D->getLocation());
+    if (PLoc.isInvalid()) {
+      return true;
+    }
+    const std::string &Path = LocCache.getNormalizedPath(PLoc);
+    if (std::none_of(DeclPathGlobs.begin(),
+                     DeclPathGlobs.end(),
+                     [&Path](const std::string &Glob) {
+                       return fnmatch(Glob.c_str(), Path.c_str(), 0) == 0;
+                     })) {
+      return true;
+    }
+  }
+  if (HasDeclNameRegex) {
+    const auto *ND = dyn_cast<NamedDecl>(D);
+    if (!ND || !DeclNameRegex.match(ND->getQualifiedNameAsString())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// With MAIN_FILE_ONLY, functions and variables declared outside of the main
+// file and never referenced are left out of their namespace. Other decls are
+// kept as types, parent pointers and decl_ptr_with_body may point to them.
+template <class ATDWriter>
+bool ASTExporter<ATDWriter>::isPrunedDecl(const Decl *D) {
+  if (isFilteredOutDecl(D)) {
+    return true;
+  }
+  if (!Options.mainFileOnly || D->isReferenced() || D->isUsed()) {
+    return false;
+  }
+  if (const auto *FD = dyn_cast<FunctionDecl>(D)) {
+    if (FD->getKind() != Decl::Function ||
+        FD->getTemplatedKind() != FunctionDecl::TK_NonTemplate) {
+      return false;
+    }
+  } else if (D->getKind() != Decl::Var) {
+    return false;
+  }
+  for (const Decl *Redecl : D->redecls()) {
+    if (isInMainFile(Redecl)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// With DECLS_ONLY, no body is dumped. With MAIN_FILE_ONLY, the bodies of the
+// code outside of the main file are not dumped. Elided bodies are flagged
+// with is_body_elided.
+template <class ATDWriter>
+bool ASTExporter<ATDWriter>::shouldDumpBody(const Decl *D) {
+  return !Options.declsOnly && (!Options.mainFileOnly || isInMainFile(D)) &&
+         !isElidedInstantiation(D);
+}
+
+// With ELIDE_TEMPLATE_INSTANTIATIONS, implicit instantiations are dumped as
+// their template_specialization, i.e. the template they instantiate and the
+// arguments: the members of classes are left out and flagged with
+// has_elided_decls, and the bodies of functions are flagged with
+// is_body_elided. As with MAIN_FILE_ONLY, decl refs may point to the members
+// left out.
+template <class ATDWriter>
+bool ASTExporter<ATDWriter>::isElidedInstantiation(const Decl *D) {
+  if (!Options.elideTemplateInstantiations) {
+    return false;
+  }
+  if (const auto *CTSD = dyn_cast<ClassTemplateSpecializationDecl>(D)) {
+    return CTSD->getSpecializationKind() == TSK_ImplicitInstantiation;
+  }
+  if (const auto *FD = dyn_cast<FunctionDecl>(D)) {
+    return FD->getPrimaryTemplate() &&
+           FD->getTemplateSpecializationKind() == TSK_ImplicitInstantiation;
+  }
+  return false;
+}
+
 //===----------------------------------------------------------------------===//
 //  Decl dumping methods.
 //===----------------------------------------------------------------------===//
@@ -1059,17 +1598,197 @@ bool ASTExporter<ATDWriter>::alwaysEmitParent(const Decl *D) {
 #define DECL(DERIVED, BASE) //@atd #define @DERIVED@_decl_tuple @BASE@_tuple
 #define ABSTRACT_DECL(DECL) DECL
 #include <clang/AST/DeclNodes.inc>
+template <class ATDWriter>
+const typename ATDWriter::Tag &ASTExporter<ATDWriter>::declKindTag(
+    Decl::Kind Kind) {
+  switch (Kind) {
+#define DECL(DERIVED, BASE)                    \
+  case Decl::DERIVED: {                        \
+    static constexpr Tag tag(#DERIVED "Decl"); \
+    return tag;                                \
+  }
+#define ABSTRACT_DECL(DECL)
+#include <clang/AST/DeclNodes.inc>
+  }
+  llvm_unreachable("Decl that isn't part of DeclNodes.inc!");
+}
+
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpDecl(const Decl *D) {
   if (!D) {
     // We use a fixed EmptyDecl node to represent null pointers
     D = NullPtrDecl;
   }
-  VariantScope Scope(OF, std::string(D->getDeclKindName()) + "Decl");
+  if (IndexedFrames) {
+    DeclFrames.emplace_back(getPointerId(D), IndexedFrames->frameOffset());
+  }
+  uint64_t Start = Stats ? OF.bytesWritten() : 0;
+  const Tag &KindTag = declKindTag(D->getKind());
   {
-    TupleScope Scope(OF, ASTExporter::tupleSizeOfDeclKind(D->getKind()));
+    VariantScope Scope(OF, KindTag);
+    TupleScope tScope(OF, ASTExporter::tupleSizeOfDeclKind(D->getKind()));
     ConstDeclVisitor<ASTExporter<ATDWriter>>::Visit(D);
   }
+  if (Stats) {
+    Stats->addNode(ExporterStats::Decls, KindTag, OF.bytesWritten() - Start);
+  }
+}
+
+// Dumps the list of the decls above Start in DeclStack and pops them.
+// Decls pushed by the nested nodes are above these ones and popped first.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpDeclStack(size_t Start) {
+  size_t End = DeclStack.size();
+  ArrayScope Scope(OF, End - Start);
+  for (size_t I = Start; I != End; ++I) {
+    dumpDecl(DeclStack[I]);
+  }
+  DeclStack.resize(Start);
+}
+
+// With FRAMED_OUTPUT, each decl of the translation unit is a frame of its
+// own, so that consumers can process them one at a time. The last frame is
+// the TranslationUnitDecl itself, with an empty list of decls, as it holds the
+// types. Each frame can be decoded on its own, see beginFrame.
+// With DECL_STORE_DIR, the frames of the decls outside of the main file are
+// moved to the store, see DeclStore, and their pointers are numbered after
+// their decl, see beginFramePointerIds.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpFramedTranslationUnit(
+    FramedOutputStream &Frames, DeclStore *Store) {
+  const TranslationUnitDecl *D = Context.getTranslationUnitDecl();
+  for (auto I : D->decls()) {
+    if (!isPrunedDecl(I)) {
+      DeclStack.push_back(I);
+    }
+  }
+  // see VisitDeclContext
+  if (Context.getObjCInstanceType().getTypePtrOrNull()) {
+    DeclStack.push_back(Context.getObjCInstanceTypeDecl());
+  }
+  if (Options.writeIndex) {
+    IndexedFrames = &Frames;
+  }
+  SmallString<64> Reference;
+  SelfContainedFrames = true;
+  if (Store) {
+    // referred to by many frames, before their own pointers
+    getPointerId(D);
+    getPointerId(NullPtrDecl);
+    for (const Type *T : Context.getTypes()) {
+      if (isa<BuiltinType>(T)) {
+        getPointerId(T);
+      }
+    }
+  }
+  // the decls of each frame are pushed above the top-level ones
+  for (size_t I = 0, E = DeclStack.size(); I != E; ++I) {
+    beginFrame();
+    if (Store) {
+      beginFramePointerIds(DeclStack[I]);
+    }
+    dumpDecl(DeclStack[I]);
+    OF.emitEndOfValue();
+    if (Store && !isInMainFile(DeclStack[I]) &&
+        Store->put(Frames.frame(), Reference)) {
+      Frames.replaceFrame(Reference);
+    }
+    Frames.endFrame();
+  }
+  DeclStack.clear();
+  FramedTopLevelDecls = true;
+  FramePointerIdBase = 0;
+  beginFrame();
+  dumpDecl(D);
+  OF.emitEndOfValue();
+  Frames.endFrame();
+  if (Options.writeIndex) {
+    IndexedFrames = nullptr;
+    dumpFrameIndex(Frames);
+  }
+}
+
+// Forgets what the previous frames refer to: the first location of a frame
+// gives its file and line in full, compact locations use a table of files of
+// their own, and with DEDUP_DECL_REFS the first reference of a frame to a
+// declaration carries its name and type. Pointers are the only links between
+// frames.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::beginFrame() {
+  LastLocFilename = "";
+  LastLocLine = ~0U;
+  LastLocFileIndex = -1;
+  LastLocColumn = ~0U;
+  FileIndexByName.clear();
+  FileIndexByPath.clear();
+  SourceFiles.clear();
+  DumpedDeclRefs.clear();
+}
+
+// With WRITE_INDEX, the last frame of a framed output is a binary index,
+// read by Yojson_utils.open_frame_index. All integers are big-endian:
+//   number of decls (32 bits), then for each decl, sorted by pointer:
+//     pointer (64 bits), offset of the frame holding the decl (64 bits)
+//   number of mangled names (32 bits), then for each one, sorted by hash:
+//     hash (64 bits), offset of the frame holding the decl (64 bits)
+//   offset of the index frame itself (64 bits)
+//   "ASTINDEX"
+// Offsets point to the length of the frame. With DECL_STORE_DIR, the frame
+// holding a decl may be a reference to the store.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpFrameIndex(FramedOutputStream &Frames) {
+  uint64_t IndexOffset = Frames.frameOffset();
+  for (auto *Entries : {&DeclFrames, &MangledNameFrames}) {
+    std::sort(Entries->begin(), Entries->end());
+    Frames.writeUInt32(Entries->size());
+    for (const auto &Entry : *Entries) {
+      Frames.writeUInt64(Entry.first);
+      Frames.writeUInt64(Entry.second);
+    }
+  }
+  Frames.writeUInt64(IndexOffset);
+  Frames << "ASTINDEX";
+  Frames.endFrame();
+}
+
+// With CHECK_SIZES, reports the first container written with another number
+// of elements than announced, typically because a *TupleSize function or the
+// size of an ObjectScope is out of sync with its visitor.
+// Returns true if there was such a container.
+template <class ATDWriter>
+bool ASTExporter<ATDWriter>::reportSizeError() {
+  const auto *E = OF.sizeError();
+  if (!E) {
+    return false;
+  }
+  const char *Container = "";
+  switch (E->container) {
+  case ::ATDWriter::SARRAY:
+    Container = "list";
+    break;
+  case ::ATDWriter::STUPLE:
+    Container = "tuple";
+    break;
+  case ::ATDWriter::SOBJECT:
+    Container = "record";
+    break;
+  case ::ATDWriter::SVARIANT:
+  case ::ATDWriter::STAG:
+    Container = "variant";
+    break;
+  }
+  llvm::errs() << "ASTExporter: a " << Container;
+  if (!E->variant.empty()) {
+    llvm::errs() << " of " << E->variant;
+  }
+  llvm::errs() << " has " << E->actual << " elements, "
+               << (E->atMost ? "at most " : "") << E->expected
+               << " expected";
+  if (E->container == ::ATDWriter::STUPLE && !E->variant.empty()) {
+    llvm::errs() << " (see " << E->variant << "TupleSize)";
+  }
+  llvm::errs() << "\n";
+  return true;
 }
 
 template <class ATDWriter>
@@ -1361,13 +2080,18 @@ void ASTExporter<ATDWriter>::dumpIntegerTypeWidths(const TargetInfo &info) {
 //@atd   input_kind : input_kind;
 //@atd   integer_type_widths : integer_type_widths;
 //@atd   types : c_type list;
+//@atd   ~source_files : source_file list;
+//@atd   ~pointer_count : int;
 //@atd } <ocaml field_prefix="tudi_">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitTranslationUnitDecl(
     const TranslationUnitDecl *D) {
   VisitDecl(D);
   VisitDeclContext(D);
-  ObjectScope Scope(OF, 4);
+  // the files of a framed output are given in each frame, see
+  // dumpCompactSourceLocation
+  bool HasSourceFiles = !SourceFiles.empty() && !SelfContainedFrames;
+  ObjectScope Scope(OF, 5 + HasSourceFiles);
   OF.emitTag("input_path");
   OF.emitString(
       Options.normalizeSourcePath(Options.inputFile.getFile().str().c_str()));
@@ -1376,13 +2100,35 @@ void ASTExporter<ATDWriter>::VisitTranslationUnitDecl(
   OF.emitTag("integer_type_widths");
   dumpIntegerTypeWidths(Context.getTargetInfo());
   OF.emitTag("types");
-  const auto &types = Context.getTypes();
-  ArrayScope aScope(OF, types.size() + 1); // + 1 for nullptr
-  for (const Type *type : types) {
-    dumpType(type);
+  if (Options.referencedTypesOnly) {
+    // Dumping a type may refer to new types, hence the unknown size
+    ArrayScope aScope(OF);
+    for (size_t I = 0; I < ReferencedTypes.size(); ++I) {
+      dumpType(ReferencedTypes[I]);
+    }
+    dumpType(nullptr);
+  } else {
+    const auto &types = Context.getTypes();
+    ArrayScope aScope(OF, types.size() + 1); // + 1 for nullptr
+    for (const Type *type : types) {
+      dumpType(type);
+    }
+    // Just in case, add NoneType to dumped types
+    dumpType(nullptr);
+  }
+  // Last, as it is filled in while dumping the locations
+  if (HasSourceFiles) {
+    OF.emitTag("source_files");
+    ArrayScope aScope(OF, SourceFiles.size());
+    for (const std::string &File : SourceFiles) {
+      OF.emitString(File);
+    }
   }
-  // Just in case, add NoneType to dumped types
-  dumpType(nullptr);
+  // Nothing is dumped after this point, so that consumers can presize their
+  // pointer indexes. Pointers are numbered from 1 unless with DECL_STORE_DIR,
+  // see beginFramePointerIds
+  OF.emitTag("pointer_count");
+  OF.emitInteger(PointerMap.size());
 }
 
 template <class ATDWriter>
@@ -1525,6 +2271,7 @@ int ASTExporter<ATDWriter>::FunctionDeclTupleSize() {
 //@atd   ~parameters : decl list;
 //@atd   ?decl_ptr_with_body : pointer option;
 //@atd   ?body : stmt option;
+//@atd   ~is_body_elided : bool;
 //@atd   ?template_specialization : template_specialization_info option
 //@atd } <ocaml field_prefix="fdi_">
 template <class ATDWriter>
@@ -1549,30 +2296,23 @@ void ASTExporter<ATDWriter>::VisitFunctionDecl(const FunctionDecl *D) {
   // FunctionDecl::hasBody() will set DeclWithBody pointer to decl that
   // has body. If there is no body in all decls of that function,
   // then we need to set DeclWithBody to nullptr manually
-  if (!D->hasBody(DeclWithBody)) {
+  if (!D->hasBody(DeclWithBody) || !shouldDumpBody(DeclWithBody)) {
     DeclWithBody = nullptr;
   }
-  bool HasDeclarationBody = D->doesThisDeclarationHaveABody();
+  bool HasDeclarationBody =
+      D->doesThisDeclarationHaveABody() && shouldDumpBody(D);
+  bool IsBodyElided =
+      D->doesThisDeclarationHaveABody() && !HasDeclarationBody;
   FunctionTemplateDecl *TemplateDecl = D->getPrimaryTemplate();
   int size = ShouldMangleName + IsCpp + IsInlineSpecified + IsModulePrivate +
              IsPure + IsDeletedAsWritten + IsNoReturn + IsVariadic +
              IsStatic + HasParameters + (bool)DeclWithBody +
-             HasDeclarationBody + (bool)TemplateDecl;
+             HasDeclarationBody + IsBodyElided + (bool)TemplateDecl;
   ObjectScope Scope(OF, size);
 
   if (ShouldMangleName) {
     OF.emitTag("mangled_name");
-    SmallString<64> Buf;
-    llvm::raw_svector_ostream StrOS(Buf);
-    if (const auto *CD = dyn_cast<CXXConstructorDecl>(D)) {
-      Mangler->mangleCXXCtor(CD, Ctor_Complete, StrOS);
-    } else if (const auto *DD = dyn_cast<CXXDestructorDecl>(D)) {
-      Mangler->mangleCXXDtor(DD, Dtor_Deleting, StrOS);
-    } else {
-      Mangler->mangleName(D, StrOS);
-    }
-    // mangled names can get ridiculously long, so hash them to a fixed size
-    OF.emitString(std::to_string(fnv64Hash(StrOS)));
+    dumpMangledNameHash(D);
   }
 
   OF.emitFlag("is_cpp", IsCpp);
@@ -1630,6 +2370,7 @@ void ASTExporter<ATDWriter>::VisitFunctionDecl(const FunctionDecl *D) {
       dumpStmt(Body);
     }
   }
+  OF.emitFlag("is_body_elided", IsBodyElided);
   if (TemplateDecl) {
     OF.emitTag("template_specialization");
     dumpTemplateSpecialization(TemplateDecl,
@@ -2059,11 +2800,7 @@ void ASTExporter<ATDWriter>::VisitClassTemplateSpecializationDecl(
   VisitCXXRecordDecl(D);
   bool ShouldMangleName = Mangler->shouldMangleDeclName(D);
   if (ShouldMangleName) {
-    SmallString<64> Buf;
-    llvm::raw_svector_ostream StrOS(Buf);
-    Mangler->mangleName(D, StrOS);
-    // mangled names can get ridiculously long, so hash them to a fixed size
-    OF.emitString(std::to_string(fnv64Hash(StrOS)));
+    dumpMangledNameHash(D);
   } else {
     OF.emitString("");
   }
@@ -2127,14 +2864,14 @@ template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitClassTemplateDecl(
     const ClassTemplateDecl *D) {
   ASTExporter<ATDWriter>::VisitRedeclarableTemplateDecl(D);
-  std::vector<const ClassTemplateSpecializationDecl *> DeclsToDump;
+  size_t Start = DeclStack.size();
   if (D == D->getCanonicalDecl()) {
     // dump specializations once
     for (const auto *spec : D->specializations()) {
       switch (spec->getTemplateSpecializationKind()) {
       case TSK_Undeclared:
       case TSK_ImplicitInstantiation:
-        DeclsToDump.push_back(spec);
+        DeclStack.push_back(spec);
         break;
       case TSK_ExplicitSpecialization:
       case TSK_ExplicitInstantiationDeclaration:
@@ -2144,14 +2881,11 @@ void ASTExporter<ATDWriter>::VisitClassTemplateDecl(
       }
     }
   }
-  bool ShouldDumpSpecializations = !DeclsToDump.empty();
+  bool ShouldDumpSpecializations = DeclStack.size() > Start;
   ObjectScope Scope(OF, 0 + ShouldDumpSpecializations);
   if (ShouldDumpSpecializations) {
     OF.emitTag("specializations");
-    ArrayScope aScope(OF, DeclsToDump.size());
-    for (const auto *spec : DeclsToDump) {
-      dumpDecl(spec);
-    }
+    dumpDeclStack(Start);
   }
 }
 
@@ -2164,7 +2898,7 @@ template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitFunctionTemplateDecl(
     const FunctionTemplateDecl *D) {
   ASTExporter<ATDWriter>::VisitRedeclarableTemplateDecl(D);
-  std::vector<const FunctionDecl *> DeclsToDump;
+  size_t Start = DeclStack.size();
   if (D == D->getCanonicalDecl()) {
     // dump specializations once
     for (const auto *spec : D->specializations()) {
@@ -2173,7 +2907,7 @@ void ASTExporter<ATDWriter>::VisitFunctionTemplateDecl(
       case TSK_ImplicitInstantiation:
       case TSK_ExplicitInstantiationDefinition:
       case TSK_ExplicitInstantiationDeclaration:
-        DeclsToDump.push_back(spec);
+        DeclStack.push_back(spec);
         break;
       case TSK_ExplicitSpecialization:
         // these specializations will be dumped when they are defined
@@ -2181,14 +2915,11 @@ void ASTExporter<ATDWriter>::VisitFunctionTemplateDecl(
       }
     }
   }
-  bool ShouldDumpSpecializations = !DeclsToDump.empty();
+  bool ShouldDumpSpecializations = DeclStack.size() > Start;
   ObjectScope Scope(OF, 0 + ShouldDumpSpecializations);
   if (ShouldDumpSpecializations) {
     OF.emitTag("specializations");
-    ArrayScope aScope(OF, DeclsToDump.size());
-    for (const auto *spec : DeclsToDump) {
-      dumpDecl(spec);
-    }
+    dumpDeclStack(Start);
   }
 }
 
@@ -2496,6 +3227,7 @@ int ASTExporter<ATDWriter>::ObjCMethodDeclTupleSize() {
 //@atd   ~is_overriding : bool;
 //@atd   ~is_optional : bool;
 //@atd   ?body : stmt option;
+//@atd   ~is_body_elided : bool;
 //@atd   ~mangled_name : string;
 //@atd } <ocaml field_prefix="omdi_">
 template <class ATDWriter>
@@ -2523,18 +3255,23 @@ void ASTExporter<ATDWriter>::VisitObjCMethodDecl(const ObjCMethodDecl *D) {
   bool IsVariadic = D->isVariadic();
   bool IsOverriding = D->isOverriding();
   bool IsOptional = D->isOptional();
-  const Stmt *Body = D->getBody();
+  const Stmt *Body = shouldDumpBody(D) ? D->getBody() : nullptr;
+  bool IsBodyElided = !Body && D->hasBody();
 
   SmallString<64> Buf;
   llvm::raw_svector_ostream StrOS(Buf);
-  Mangler->mangleObjCMethodNameWithoutSize(D, StrOS);
+  {
+    ExporterStats::Timer Timer(Stats, ExporterStats::Mangling);
+    Mangler->mangleObjCMethodNameWithoutSize(D, StrOS);
+  }
   std::string MangledName = StrOS.str();
 
   ObjectScope Scope(OF,
                     1 + IsInstanceMethod + IsPropertyAccessor +
                         (bool)PropertyDecl + HasParameters +
                         HasImplicitParameters + IsVariadic + IsOverriding +
-                        IsOptional + (bool)Body + 1 /*MangledName */);
+                        IsOptional + (bool)Body + IsBodyElided +
+                        1 /*MangledName */);
 
   OF.emitFlag("is_instance_method", IsInstanceMethod);
   OF.emitTag("result_type");
@@ -2569,6 +3306,7 @@ void ASTExporter<ATDWriter>::VisitObjCMethodDecl(const ObjCMethodDecl *D) {
     OF.emitTag("body");
     dumpStmt(Body);
   }
+  OF.emitFlag("is_body_elided", IsBodyElided);
 
   OF.emitTag("mangled_name");
   OF.emitString(MangledName);
@@ -2958,6 +3696,7 @@ int ASTExporter<ATDWriter>::BlockDeclTupleSize() {
 //@atd   ~captures_cxx_this : bool;
 //@atd   ~captured_variables : block_captured_variable list;
 //@atd   ?body : stmt option;
+//@atd   ~is_body_elided : bool;
 //@atd   ~mangled_name : string;
 //@atd } <ocaml field_prefix="bdi_">
 //@atd type block_captured_variable = {
@@ -2979,15 +3718,20 @@ void ASTExporter<ATDWriter>::VisitBlockDecl(const BlockDecl *D) {
   BlockDecl::capture_const_iterator CII = D->capture_begin(),
                                     CIE = D->capture_end();
   bool HasCapturedVariables = CII != CIE;
-  const Stmt *Body = D->getBody();
+  const Stmt *Body = shouldDumpBody(D) ? D->getBody() : nullptr;
+  bool IsBodyElided = !Body && D->hasBody();
 
   SmallString<64> Buf;
   llvm::raw_svector_ostream StrOS(Buf);
-  Mangler->mangleBlock(D->getDeclContext(), D, StrOS);
+  {
+    ExporterStats::Timer Timer(Stats, ExporterStats::Mangling);
+    Mangler->mangleBlock(D->getDeclContext(), D, StrOS);
+  }
   std::string MangledName = StrOS.str();
 
   int size = 0 + HasParameters + IsVariadic + CapturesCXXThis +
-             HasCapturedVariables + (bool)Body + 1 /* MangledName*/;
+             HasCapturedVariables + (bool)Body + IsBodyElided +
+             1 /* MangledName*/;
   ObjectScope Scope(OF, size); // not covered by tests
 
   if (HasParameters) {
@@ -3031,6 +3775,7 @@ void ASTExporter<ATDWriter>::VisitBlockDecl(const BlockDecl *D) {
     OF.emitTag("body");
     dumpStmt(Body);
   }
+  OF.emitFlag("is_body_elided", IsBodyElided);
 
   OF.emitTag("mangled_name");
   OF.emitString(MangledName);
@@ -3054,15 +3799,73 @@ void ASTExporter<ATDWriter>::VisitBlockDecl(const BlockDecl *D) {
 #include <clang/AST/StmtNodes.inc>
 //
 template <class ATDWriter>
-void ASTExporter<ATDWriter>::dumpStmt(const Stmt *S) {
-  if (!S) {
-    // We use a fixed NullStmt node to represent null pointers
-    S = NullPtrStmt;
+const typename ATDWriter::Tag &ASTExporter<ATDWriter>::stmtClassTag(
+    Stmt::StmtClass Class) {
+  switch (Class) {
+#define STMT(CLASS, PARENT)           \
+  case Stmt::CLASS##Class: {          \
+    static constexpr Tag tag(#CLASS); \
+    return tag;                       \
   }
-  VariantScope Scope(OF, S->getStmtClassName());
-  {
-    TupleScope Scope(OF, ASTExporter::tupleSizeOfStmtClass(S->getStmtClass()));
-    ConstStmtVisitor<ASTExporter<ATDWriter>>::Visit(S);
+#define ABSTRACT_STMT(STMT)
+#include <clang/AST/StmtNodes.inc>
+  case Stmt::NoStmtClass:
+    break;
+  }
+  llvm_unreachable("Stmt that isn't part of StmtNodes.inc!");
+}
+
+// Children are dumped with an explicit stack rather than recursively, as
+// generated code can nest statements very deeply. The head of the tuple of a
+// statement (stmt_tuple) is dumped by dumpStmtHead when the statement is
+// entered, the rest of it by the visitor once its children are dumped: every
+// visitor calls the visitor of its parent class first, and VisitStmt emits
+// nothing.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpStmt(const Stmt *S) {
+  struct PendingStmt {
+    const Stmt *S;
+    Stmt::const_child_iterator Next;
+    Stmt::const_child_iterator End;
+    // with AST_EXPORTER_STATS, bytes written before the statement
+    uint64_t Start;
+  };
+  SmallVector<PendingStmt, 32> Stack;
+  auto Enter = [this, &Stack](const Stmt *S) {
+    if (!S) {
+      // We use a fixed NullStmt node to represent null pointers
+      S = NullPtrStmt;
+    }
+    uint64_t Start = Stats ? OF.bytesWritten() : 0;
+    OF.enterVariant(stmtClassTag(S->getStmtClass()));
+    OF.enterTuple(ASTExporter::tupleSizeOfStmtClass(S->getStmtClass()));
+    ++StmtDepth;
+    if (dumpStmtHead(S)) {
+      Stack.push_back({S, S->child_begin(), S->child_end(), Start});
+    } else {
+      Stack.push_back({S, S->child_end(), S->child_end(), Start});
+    }
+  };
+  Enter(S);
+  while (!Stack.empty()) {
+    PendingStmt &Top = Stack.back();
+    if (Top.Next != Top.End) {
+      Enter(*Top.Next++);
+      continue;
+    }
+    const Stmt *Done = Top.S;
+    uint64_t Start = Top.Start;
+    Stack.pop_back();
+    OF.leaveArray();
+    ConstStmtVisitor<ASTExporter<ATDWriter>>::Visit(Done);
+    --StmtDepth;
+    OF.leaveTuple();
+    OF.leaveVariant();
+    if (Stats) {
+      Stats->addNode(ExporterStats::Stmts,
+                     stmtClassTag(Done->getStmtClass()),
+                     OF.bytesWritten() - Start);
+    }
   }
 }
 
@@ -3074,25 +3877,38 @@ int ASTExporter<ATDWriter>::StmtTupleSize() {
 //@atd type stmt_info = {
 //@atd   pointer : pointer;
 //@atd   source_range : source_range;
+//@atd   ~has_elided_children : bool;
 //@atd } <ocaml field_prefix="si_">
-template <class ATDWriter>
-void ASTExporter<ATDWriter>::VisitStmt(const Stmt *S) {
+// Dumps the stmt_info and enters the list of children, which the caller
+// fills in and leaves. Returns false if the children are elided: with
+// MAX_STMT_DEPTH, the children of the statements at the maximum depth are
+// elided. Pointers to them, e.g. in if_stmt_info, are left dangling.
+template <class ATDWriter>
+bool ASTExporter<ATDWriter>::dumpStmtHead(const Stmt *S) {
+  bool HasElidedChildren = Options.maxStmtDepth &&
+                           StmtDepth >= Options.maxStmtDepth &&
+                           S->child_begin() != S->child_end();
   {
-    ObjectScope Scope(OF, 2);
+    ObjectScope Scope(OF, 2 + HasElidedChildren);
 
     OF.emitTag("pointer");
     dumpPointer(S);
     OF.emitTag("source_range");
     dumpSourceRange(S->getSourceRange());
+    OF.emitFlag("has_elided_children", HasElidedChildren);
   }
-  {
-    ArrayScope Scope(OF, std::distance(S->child_begin(), S->child_end()));
-    for (const Stmt *CI : S->children()) {
-      dumpStmt(CI);
-    }
+  if (HasElidedChildren) {
+    OF.enterArray(0);
+    return false;
   }
+  OF.enterArray(std::distance(S->child_begin(), S->child_end()));
+  return true;
 }
 
+// stmt_info and children are dumped by dumpStmt
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::VisitStmt(const Stmt *S) {}
+
 template <class ATDWriter>
 int ASTExporter<ATDWriter>::DeclStmtTupleSize() {
   return StmtTupleSize() + 1;
@@ -3628,23 +4444,47 @@ void ASTExporter<ATDWriter>::VisitFloatingLiteral(const FloatingLiteral *Node) {
 
 template <class ATDWriter>
 int ASTExporter<ATDWriter>::StringLiteralTupleSize() {
-  return ExprTupleSize() + 1;
-}
-//@atd #define string_literal_tuple expr_tuple * string list
+  return ExprTupleSize() + 2;
+}
+// The bytes of the literal, in chunks of at most MAX_STRING_SIZE. The first
+// chunk is never empty unless it is the only one. With
+// STRING_LITERAL_HASH_THRESHOLD, the bytes of the literals longer than the
+// threshold are replaced by an empty list and elided_string holds their
+// length and the decimal fnv64 hash of their bytes.
+//@atd #define string_literal_tuple expr_tuple * string list * string_literal_info
+//@atd type string_literal_info = {
+//@atd   ?elided_string : (int * string) option;
+//@atd } <ocaml field_prefix="sli_">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitStringLiteral(const StringLiteral *Str) {
   VisitExpr(Str);
+  StringRef Bytes = Str->getBytes();
+  if (Options.stringLiteralHashThreshold > 0 &&
+      Bytes.size() > Options.stringLiteralHashThreshold) {
+    { ArrayScope Scope(OF, 0); }
+    ObjectScope Scope(OF, 1);
+    OF.emitTag("elided_string");
+    TupleScope Tuple(OF, 2);
+    OF.emitInteger(Bytes.size());
+    OF.emitString(std::to_string(
+        fnv64Hash(FNV64_hash_start, Bytes.data(), Bytes.size())));
+    return;
+  }
   size_t n_chunks;
   if (Str->getByteLength() == 0) {
     n_chunks = 1;
   } else {
     n_chunks = 1 + ((Str->getByteLength() - 1) / Options.maxStringSize);
   }
-  ArrayScope Scope(OF, n_chunks);
-  for (size_t i = 0; i < n_chunks; ++i) {
-    OF.emitString(Str->getBytes().substr(i * Options.maxStringSize,
-                                         Options.maxStringSize));
+  {
+    ArrayScope Scope(OF, n_chunks);
+    for (size_t i = 0; i < n_chunks; ++i) {
+      // views over the bytes of the literal, see GenWriter::emitString
+      OF.emitString(
+          Bytes.substr(i * Options.maxStringSize, Options.maxStringSize));
+    }
   }
+  ObjectScope Scope(OF, 0);
 }
 
 template <class ATDWriter>
@@ -4583,13 +5423,32 @@ void ASTExporter<ATDWriter>::dumpFullComment(const FullComment *C) {
 #define COMMENT(CLASS, PARENT) //@atd #define @CLASS@_tuple @PARENT@_tuple
 #define ABSTRACT_COMMENT(COMMENT) COMMENT
 #include <clang/AST/CommentNodes.inc>
+template <class ATDWriter>
+const typename ATDWriter::Tag &ASTExporter<ATDWriter>::commentKindTag(
+    Comment::CommentKind Kind) {
+  switch (Kind) {
+#define COMMENT(CLASS, PARENT)        \
+  case Comment::CLASS##Kind: {        \
+    static constexpr Tag tag(#CLASS); \
+    return tag;                       \
+  }
+#define ABSTRACT_COMMENT(COMMENT)
+#include <clang/AST/CommentNodes.inc>
+  case Comment::NoCommentKind: {
+    static constexpr Tag tag("NoCommentKind");
+    return tag;
+  }
+  }
+  llvm_unreachable("Comment that isn't part of CommentNodes.inc!");
+}
+
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpComment(const Comment *C) {
   if (!C) {
     // We use a fixed NoComment node to represent null pointers
     C = NullPtrComment;
   }
-  VariantScope Scope(OF, std::string(C->getCommentKindName()));
+  VariantScope Scope(OF, commentKindTag(C->getCommentKind()));
   {
     TupleScope Scope(OF,
                      ASTExporter::tupleSizeOfCommentKind(C->getCommentKind()));
@@ -4751,11 +5610,30 @@ TYPE(None, Type)
 #undef ABSTRACT_TYPE
 
 template <class ATDWriter>
-void ASTExporter<ATDWriter>::dumpType(const Type *T) {
+const typename ATDWriter::Tag &ASTExporter<ATDWriter>::typeClassTag(
+    const Type *T) {
+  if (!T) {
+    static constexpr Tag tag("NoneType");
+    return tag;
+  }
+  switch (T->getTypeClass()) {
+#define TYPE(DERIVED, BASE)                    \
+  case Type::DERIVED: {                        \
+    static constexpr Tag tag(#DERIVED "Type"); \
+    return tag;                                \
+  }
+#define ABSTRACT_TYPE(DERIVED, BASE)
+#include <clang/AST/TypeNodes.def>
+  }
+  llvm_unreachable("Type that isn't part of TypeNodes.def!");
+}
 
-  std::string typeClassName = T ? T->getTypeClassName() : "None";
-  VariantScope Scope(OF, typeClassName + "Type");
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpType(const Type *T) {
+  uint64_t Start = Stats ? OF.bytesWritten() : 0;
+  const Tag &ClassTag = typeClassTag(T);
   {
+    VariantScope Scope(OF, ClassTag);
     if (T) {
       // TypeVisitor assumes T is non-null
       TupleScope Scope(OF,
@@ -4766,11 +5644,17 @@ void ASTExporter<ATDWriter>::dumpType(const Type *T) {
       VisitType(nullptr);
     }
   }
+  if (Stats) {
+    Stats->addNode(ExporterStats::Types, ClassTag, OF.bytesWritten() - Start);
+  }
 }
 
 //@atd type type_ptr = int wrap <ocaml module="Clang_ast_types.TypePtr">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpPointerToType(const Type *T) {
+  if (Options.referencedTypesOnly && T) {
+    ReferencedTypes.insert(T);
+  }
   dumpPointer(T);
 }
 
@@ -5194,16 +6078,22 @@ void ASTExporter<ATDWriter>::VisitTypedefType(const TypedefType *T) {
 //===----------------------------------------------------------------------===//
 
 template <class ATDWriter>
-void ASTExporter<ATDWriter>::dumpAttr(const Attr *A) {
-  std::string tag;
-  switch (A->getKind()) {
-#define ATTR(NAME)       \
-  case attr::Kind::NAME: \
-    tag = #NAME "Attr";  \
-    break;
+const typename ATDWriter::Tag &ASTExporter<ATDWriter>::attrKindTag(
+    attr::Kind Kind) {
+  switch (Kind) {
+#define ATTR(NAME)                          \
+  case attr::Kind::NAME: {                  \
+    static constexpr Tag tag(#NAME "Attr"); \
+    return tag;                             \
+  }
 #include <clang/Basic/AttrList.inc>
   }
-  VariantScope Scope(OF, tag);
+  llvm_unreachable("Attr that isn't part of AttrList.inc!");
+}
+
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpAttr(const Attr *A) {
+  VariantScope Scope(OF, attrKindTag(A->getKind()));
   {
     TupleScope Scope(OF, ASTExporter::tupleSizeOfAttrKind(A->getKind()));
     ConstAttrVisitor<ASTExporter<ATDWriter>>::Visit(A);
@@ -5271,7 +6161,7 @@ int ASTExporter<ATDWriter>::AnnotateAttrTupleSize() {
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitAnnotateAttr(const AnnotateAttr *A) {
   VisitAttr(A);
-  OF.emitString(A->getAnnotation().str());
+  OF.emitString(A->getAnnotation());
 }
 
 template <class ATDWriter>
@@ -5377,9 +6267,60 @@ class ExporterASTConsumer : public ASTConsumer {
   }
 
   virtual void HandleTranslationUnit(ASTContext &Context) {
-    TranslationUnitDecl *D = Context.getTranslationUnitDecl();
-    ASTExporter<ATDWriter> P(*OS, Context, *options);
-    P.dumpDecl(D);
+    // outputs named *.gz are compressed, cached exports are not
+    std::unique_ptr<GzipOutputStream> Gzip;
+    if (StringRef(options->outputFile).endswith(".gz")) {
+      Gzip.reset(new GzipOutputStream(*OS));
+    }
+    raw_ostream &Dest = Gzip ? *Gzip : *OS;
+    DeclStore Store;
+    bool UseStore = options->framedOutput && !options->declStoreDir.empty() &&
+                    Store.open(options->declStoreDir);
+    ExportCache Cache;
+    bool UseCache =
+        !options->exportCacheDir.empty() &&
+        Cache.open(options->exportCacheDir,
+                   Context,
+                   options->cacheKey() +
+                       (std::is_same<ATDWriter, JsonWriter>::value ? "json"
+                                                                   : "biniou"));
+    if (UseCache && Cache.replay(Dest, UseStore ? &Store : nullptr)) {
+      return;
+    }
+    raw_ostream &Recorded = UseCache ? Cache.record(Dest) : Dest;
+    std::unique_ptr<AsyncOutputStream> Async;
+    if (options->asyncOutput) {
+      Async.reset(new AsyncOutputStream(Recorded));
+    }
+    raw_ostream &Out = Async ? *Async : Recorded;
+    std::unique_ptr<ExporterStats> Stats;
+    if (options->stats) {
+      Stats.reset(new ExporterStats());
+    }
+    uint64_t OutStart = Out.tell();
+    if (options->framedOutput) {
+      FramedOutputStream Frames(Out);
+      ASTExporter<ATDWriter> P(Frames, Context, *options, Stats.get());
+      P.dumpFramedTranslationUnit(Frames, UseStore ? &Store : nullptr);
+      P.reportSizeError();
+    } else {
+      ASTExporter<ATDWriter> P(Out, Context, *options, Stats.get());
+      P.dumpDecl(Context.getTranslationUnitDecl());
+      P.reportSizeError();
+    }
+    uint64_t OutputBytes = Out.tell() - OutStart;
+    // wait for the output to be written
+    Async.reset();
+    if (Stats) {
+      // there is no file to write the counters next to
+      Stats->writeSummary(ASTPluginLib::isStreamOutput(options->outputFile)
+                              ? "-"
+                              : options->outputFile,
+                          OutputBytes);
+    }
+    if (UseCache) {
+      Cache.store();
+    }
   }
 };
 
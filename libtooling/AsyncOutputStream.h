@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+
+namespace ASTLib {
+
+// Stream handing its output over to a thread of its own, which writes it to
+// the underlying stream in chunks, so that the compression and the writes of
+// the output overlap with the export. At most MaxPendingChunks are waiting
+// to be written, the export is blocked beyond that. The underlying stream is
+// flushed and the thread is joined on destruction.
+class AsyncOutputStream : public llvm::raw_ostream {
+  static const size_t ChunkSize = 1 << 20;
+  static const size_t MaxPendingChunks = 8;
+
+  llvm::raw_ostream &OS;
+  uint64_t Pos;
+  std::vector<char> Chunk;
+  // shared with the writer thread
+  std::mutex Mutex;
+  std::condition_variable ChunkPushed;
+  std::condition_variable ChunkPopped;
+  std::deque<std::vector<char>> Pending;
+  bool Done;
+  std::thread Writer;
+
+  void pushChunk() {
+    if (Chunk.empty()) {
+      return;
+    }
+    std::unique_lock<std::mutex> Lock(Mutex);
+    ChunkPopped.wait(Lock, [this] { return Pending.size() < MaxPendingChunks; });
+    Pending.push_back(std::move(Chunk));
+    ChunkPushed.notify_one();
+    Chunk.clear();
+    Chunk.reserve(ChunkSize);
+  }
+
+  void writeChunks() {
+    std::unique_lock<std::mutex> Lock(Mutex);
+    while (true) {
+      ChunkPushed.wait(Lock, [this] { return Done || !Pending.empty(); });
+      if (Pending.empty()) {
+        break;
+      }
+      std::vector<char> Next = std::move(Pending.front());
+      Pending.pop_front();
+      ChunkPopped.notify_one();
+      Lock.unlock();
+      OS.write(Next.data(), Next.size());
+      Lock.lock();
+    }
+    Lock.unlock();
+    OS.flush();
+  }
+
+  void write_impl(const char *Ptr, size_t Size) override {
+    Pos += Size;
+    while (Size > 0) {
+      size_t N = std::min(Size, ChunkSize - Chunk.size());
+      Chunk.insert(Chunk.end(), Ptr, Ptr + N);
+      Ptr += N;
+      Size -= N;
+      if (Chunk.size() == ChunkSize) {
+        pushChunk();
+      }
+    }
+  }
+  uint64_t current_pos() const override {
+    return Pos;
+  }
+
+ public:
+  explicit AsyncOutputStream(llvm::raw_ostream &OS)
+      : OS(OS), Pos(0), Done(false) {
+    Chunk.reserve(ChunkSize);
+    Writer = std::thread(&AsyncOutputStream::writeChunks, this);
+  }
+  ~AsyncOutputStream() override {
+    flush();
+    pushChunk();
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      Done = true;
+    }
+    ChunkPushed.notify_one();
+    Writer.join();
+  }
+};
+
+} // end of namespace ASTLib
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace ASTLib {
+
+// Directory of frames shared by the framed outputs of several translation
+// units, see DECL_STORE_DIR. A frame is stored under the MD5 of its content,
+// so that the frames of the decls of a header are stored once for all the
+// translation units that export them identically, and it is replaced in the
+// output by a reference frame:
+//   "ASTSTORE" followed by the MD5 of the content, in hex
+// Frames of headers are identical across translation units as their pointers
+// are numbered after their decl, see ASTExporter::beginFramePointerIds.
+// Replacing the reference frames by the content of the files they name gives
+// back a self-contained output, as Yojson_utils.iter_frames_from_file does
+// when given the store, or scripts/expand_decl_store.py, which also moves the
+// offsets of the index of WRITE_INDEX.
+class DeclStore {
+  std::string Dir;
+
+ public:
+  // Returns false if the directory cannot be created.
+  bool open(const std::string &StoreDir) {
+    if (llvm::sys::fs::create_directories(StoreDir)) {
+      llvm::errs() << "Cannot create the decl store directory " << StoreDir
+                   << "\n";
+      return false;
+    }
+    Dir = StoreDir;
+    return true;
+  }
+
+  // Stores the content of a frame if it is not there already, and writes the
+  // reference frame to use instead in Reference.
+  // Returns false if the frame is kept in the output, because it is not
+  // larger than a reference or it cannot be stored.
+  bool put(llvm::StringRef Frame, llvm::SmallVectorImpl<char> &Reference) {
+    llvm::StringRef Magic = "ASTSTORE";
+    // the frame would not get any smaller
+    if (Frame.size() <= Magic.size() + 32) {
+      return false;
+    }
+    llvm::MD5 Hash;
+    Hash.update(Frame);
+    llvm::MD5::MD5Result Result;
+    Hash.final(Result);
+    llvm::SmallString<32> Digest = Result.digest();
+    llvm::SmallString<1024> Path(Dir);
+    llvm::sys::path::append(Path, Digest);
+    if (!llvm::sys::fs::exists(Path)) {
+      int FD;
+      llvm::SmallString<1024> Tmp;
+      if (llvm::sys::fs::createUniqueFile(Path + "-%%%%%%.tmp", FD, Tmp)) {
+        return false;
+      }
+      bool Failed;
+      {
+        llvm::raw_fd_ostream TmpOS(FD, /*shouldClose=*/true);
+        TmpOS << Frame;
+        TmpOS.close();
+        Failed = TmpOS.has_error();
+        TmpOS.clear_error();
+      }
+      // concurrent exports store the same content under the same name
+      if (Failed || llvm::sys::fs::rename(Tmp, Path)) {
+        llvm::sys::fs::remove(Tmp);
+        return false;
+      }
+    }
+    Reference.clear();
+    Reference.append(Magic.begin(), Magic.end());
+    Reference.append(Digest.begin(), Digest.end());
+    return true;
+  }
+
+  // Whether the store holds all the frames referred to by a framed output.
+  bool hasReferencedFrames(llvm::StringRef Output) const {
+    llvm::StringRef Magic = "ASTSTORE";
+    while (Output.size() >= 4) {
+      const unsigned char *Header = Output.bytes_begin();
+      size_t Size = (size_t)Header[0] << 24 | Header[1] << 16 |
+                    Header[2] << 8 | Header[3];
+      llvm::StringRef Frame = Output.substr(4, Size);
+      Output = Output.drop_front(std::min(Output.size(), 4 + Size));
+      if (Frame.size() == Magic.size() + 32 && Frame.startswith(Magic)) {
+        llvm::SmallString<1024> Path(Dir);
+        llvm::sys::path::append(Path, Frame.drop_front(Magic.size()));
+        if (!llvm::sys::fs::exists(Path)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+};
+
+} // end of namespace ASTLib
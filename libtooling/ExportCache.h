@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <dlfcn.h>
+#include <memory>
+#include <string>
+
+#include <clang/AST/ASTContext.h>
+#include <clang/Basic/SourceManager.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "DeclStore.h"
+
+namespace ASTLib {
+
+using namespace clang;
+
+// Directory of previously exported translation units. An artifact is named
+// after the MD5 of every buffer read by the preprocessor, the predefines
+// buffer included (it carries the macros given on the command line and the
+// target), of a key describing the output options, and of the identity of the
+// binary of the exporter, so that an upgraded plugin does not replay the
+// outputs of the previous one.
+// Translation units using an external AST source (PCH, modules) are not
+// cached as their content is not read through the SourceManager.
+class ExportCache {
+  // Forwards everything to the output of the plugin and to an artifact
+  class TeeStream : public llvm::raw_ostream {
+    llvm::raw_ostream &OS;
+    llvm::raw_fd_ostream &Artifact;
+    uint64_t Pos;
+
+    void write_impl(const char *Ptr, size_t Size) override {
+      OS.write(Ptr, Size);
+      Artifact.write(Ptr, Size);
+      Pos += Size;
+    }
+    uint64_t current_pos() const override {
+      return Pos;
+    }
+
+   public:
+    TeeStream(llvm::raw_ostream &OS, llvm::raw_fd_ostream &Artifact)
+        : OS(OS), Artifact(Artifact), Pos(0) {}
+    ~TeeStream() override {
+      flush();
+    }
+  };
+
+  // Identity of the plugin or of the executable holding the exporter: its
+  // path, size, modification time and inode, computed once per process. The
+  // binary itself is not hashed, as this runs for every translation unit in
+  // plugin mode, cache hits included. Empty if the binary cannot be found.
+  static const std::string &exporterIdentity() {
+    static const char Anchor = 0;
+    static const std::string Identity = [] {
+      Dl_info Info;
+      llvm::SmallString<1024> Path;
+      llvm::sys::fs::file_status Status;
+      if (!dladdr(&Anchor, &Info) || !Info.dli_fname ||
+          llvm::sys::fs::real_path(Info.dli_fname, Path) ||
+          llvm::sys::fs::status(Path, Status)) {
+        // the main executable may be known by its name only
+        if (llvm::sys::fs::real_path("/proc/self/exe", Path) ||
+            llvm::sys::fs::status(Path, Status)) {
+          return std::string();
+        }
+      }
+      std::string Result;
+      llvm::raw_string_ostream OS(Result);
+      OS << Path << '\0' << Status.getSize() << ' '
+         << Status.getLastModificationTime().time_since_epoch().count() << ' '
+         << Status.getUniqueID().getDevice() << ' '
+         << Status.getUniqueID().getFile();
+      return OS.str();
+    }();
+    return Identity;
+  }
+
+  std::string ArtifactPath;
+  std::string TmpPath;
+  std::unique_ptr<llvm::raw_fd_ostream> TmpOS;
+  std::unique_ptr<TeeStream> Tee;
+
+ public:
+  ~ExportCache() {
+    // the export was not completed
+    if (Tee) {
+      Tee.reset();
+      TmpOS->clear_error();
+      TmpOS.reset();
+      llvm::sys::fs::remove(TmpPath);
+    }
+  }
+
+  // Computes the name of the artifact of the translation unit.
+  // Returns false if the translation unit cannot be cached.
+  bool open(const std::string &Dir,
+            const ASTContext &Context,
+            llvm::StringRef OptionsKey) {
+    if (Context.getExternalSource() || exporterIdentity().empty()) {
+      return false;
+    }
+    const SourceManager &SM = Context.getSourceManager();
+    llvm::MD5 Hash;
+    Hash.update(exporterIdentity());
+    Hash.update(OptionsKey);
+    llvm::DenseSet<const SrcMgr::ContentCache *> Seen;
+    for (unsigned I = 0, E = SM.local_sloc_entry_size(); I != E; ++I) {
+      const SrcMgr::SLocEntry &Entry = SM.getLocalSLocEntry(I);
+      if (!Entry.isFile()) {
+        continue;
+      }
+      const SrcMgr::ContentCache *Content = Entry.getFile().getContentCache();
+      if (!Seen.insert(Content).second) {
+        continue;
+      }
+      const llvm::MemoryBuffer *Buffer = Content->getRawBuffer();
+      if (!Buffer) {
+        return false;
+      }
+      // separators keep the concatenation unambiguous
+      Hash.update(Buffer->getBufferIdentifier());
+      Hash.update(llvm::StringRef("\0", 1));
+      Hash.update(std::to_string(Buffer->getBufferSize()));
+      Hash.update(llvm::StringRef("\0", 1));
+      Hash.update(Buffer->getBuffer());
+    }
+    llvm::MD5::MD5Result Result;
+    Hash.final(Result);
+    if (llvm::sys::fs::create_directories(Dir)) {
+      llvm::errs() << "Cannot create the export cache directory " << Dir
+                   << "\n";
+      return false;
+    }
+    llvm::SmallString<1024> Path(Dir);
+    llvm::sys::path::append(Path, Result.digest());
+    ArtifactPath = Path.str();
+    return true;
+  }
+
+  // Writes the artifact to OS if it exists. With a store, the artifact of a
+  // framed output is only replayed if the store still holds every frame it
+  // refers to.
+  bool replay(llvm::raw_ostream &OS, const DeclStore *Store = nullptr) {
+    auto Artifact = llvm::MemoryBuffer::getFile(ArtifactPath);
+    if (!Artifact ||
+        (Store && !Store->hasReferencedFrames((*Artifact)->getBuffer()))) {
+      return false;
+    }
+    OS << (*Artifact)->getBuffer();
+    return true;
+  }
+
+  // Stream to export into, which also records a new artifact.
+  // Falls back on OS if the artifact cannot be created.
+  llvm::raw_ostream &record(llvm::raw_ostream &OS) {
+    int FD;
+    llvm::SmallString<1024> Tmp;
+    if (llvm::sys::fs::createUniqueFile(
+            ArtifactPath + "-%%%%%%.tmp", FD, Tmp)) {
+      return OS;
+    }
+    TmpPath = Tmp.str();
+    TmpOS.reset(new llvm::raw_fd_ostream(FD, /*shouldClose=*/true));
+    Tee.reset(new TeeStream(OS, *TmpOS));
+    return *Tee;
+  }
+
+  // Moves the recorded artifact in place, once the export is complete.
+  // Concurrent exports of the same translation unit write the same content.
+  void store() {
+    if (!Tee) {
+      return;
+    }
+    Tee.reset();
+    TmpOS->close();
+    bool Failed = TmpOS->has_error();
+    TmpOS->clear_error();
+    TmpOS.reset();
+    if (Failed || llvm::sys::fs::rename(TmpPath, ArtifactPath)) {
+      llvm::sys::fs::remove(TmpPath);
+    }
+  }
+};
+
+} // end of namespace ASTLib
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "atdlib/ATDWriter.h"
+
+namespace ASTLib {
+
+// Counters of AST_EXPORTER_STATS: number of nodes and of bytes written per
+// decl kind, stmt class and type class, and time spent in the helpers of the
+// exporter. The bytes of a node include the ones of its children, and so
+// does the time of a helper.
+class ExporterStats {
+ public:
+  enum NodeKind { Decls, Stmts, Types, NumNodeKinds };
+  enum Phase { Mangling, NamePrinting, SourceLocations, NumPhases };
+
+  typedef std::chrono::steady_clock Clock;
+
+  // Adds the time spent in its scope to a phase, if Stats is not null
+  class Timer {
+    ExporterStats *Stats;
+    Phase P;
+    Clock::time_point Start;
+
+   public:
+    Timer(ExporterStats *Stats, Phase P) : Stats(Stats), P(P) {
+      if (Stats) {
+        Start = Clock::now();
+      }
+    }
+    ~Timer() {
+      if (Stats) {
+        Stats->Times[P] += Clock::now() - Start;
+      }
+    }
+  };
+
+ private:
+  struct NodeStats {
+    uint64_t Count = 0;
+    uint64_t Bytes = 0;
+  };
+  typedef ATDWriter::Tag Tag;
+  typedef ATDWriter::JsonWriter<llvm::raw_ostream> JsonWriter;
+
+  // Variant tags of the nodes are static, see ASTExporter::declKindTag
+  llvm::DenseMap<const Tag *, NodeStats> Nodes[NumNodeKinds];
+  Clock::duration Times[NumPhases];
+  Clock::time_point Start;
+
+  static int64_t microseconds(Clock::duration D) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(D).count();
+  }
+
+  void dumpNodes(JsonWriter &OF, NodeKind Kind) const {
+    // largest first
+    std::vector<std::pair<const Tag *, NodeStats>> Sorted(Nodes[Kind].begin(),
+                                                         Nodes[Kind].end());
+    std::sort(Sorted.begin(),
+              Sorted.end(),
+              [](const std::pair<const Tag *, NodeStats> &A,
+                 const std::pair<const Tag *, NodeStats> &B) {
+                return A.second.Bytes > B.second.Bytes;
+              });
+    JsonWriter::ObjectScope Scope(OF, Sorted.size());
+    for (const auto &Node : Sorted) {
+      OF.emitTag(*Node.first);
+      JsonWriter::ObjectScope Scope(OF, 2);
+      OF.emitTag("count");
+      OF.emitInteger(Node.second.Count);
+      OF.emitTag("bytes");
+      OF.emitInteger(Node.second.Bytes);
+    }
+  }
+
+ public:
+  ExporterStats() : Times(), Start(Clock::now()) {}
+
+  void addNode(NodeKind Kind, const Tag &T, uint64_t Bytes) {
+    NodeStats &Stats = Nodes[Kind][&T];
+    Stats.Count++;
+    Stats.Bytes += Bytes;
+  }
+
+  // Writes the summary to OutputFile.stats.json, or to stderr if the output
+  // is stdout
+  void writeSummary(const std::string &OutputFile, uint64_t OutputBytes) {
+    Clock::duration Total = Clock::now() - Start;
+    std::unique_ptr<llvm::raw_fd_ostream> File;
+    if (!OutputFile.empty() && OutputFile != "-") {
+      std::error_code EC;
+      File.reset(new llvm::raw_fd_ostream(
+          OutputFile + ".stats.json", EC, llvm::sys::fs::F_Text));
+      if (EC) {
+        llvm::errs() << "Cannot write the export stats: " << EC.message()
+                     << "\n";
+        return;
+      }
+    }
+    llvm::raw_ostream &OS = File ? *File : llvm::errs();
+    const ATDWriter::ATDWriterOptions Options = {
+        .useYojson = false,
+        .prettifyJson = true,
+        .streamContainers = false,
+    };
+    JsonWriter OF(OS, Options);
+    JsonWriter::ObjectScope Scope(OF, 6);
+    OF.emitTag("total_time_us");
+    OF.emitInteger(microseconds(Total));
+    OF.emitTag("output_bytes");
+    OF.emitInteger(OutputBytes);
+    OF.emitTag("phase_times_us");
+    {
+      JsonWriter::ObjectScope Scope(OF, NumPhases);
+      OF.emitTag("mangling");
+      OF.emitInteger(microseconds(Times[Mangling]));
+      OF.emitTag("name_printing");
+      OF.emitInteger(microseconds(Times[NamePrinting]));
+      OF.emitTag("source_locations");
+      OF.emitInteger(microseconds(Times[SourceLocations]));
+    }
+    OF.emitTag("decls");
+    dumpNodes(OF, Decls);
+    OF.emitTag("stmts");
+    dumpNodes(OF, Stmts);
+    OF.emitTag("types");
+    dumpNodes(OF, Types);
+  }
+};
+
+} // end of namespace ASTLib
@@ -6,85 +6,110 @@
  */
 
 #include <clang/AST/AST.h>
+#include <llvm/ADT/SmallString.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/Support/Path.h>
-#include <vector>
 
 #include "FileUtils.h"
 
 namespace FileUtils {
 
-/**
- * Simplify away "." and ".." elements.
- * If pathToNormalize is a relative path, it will be pre-pended with
- * currentWorkingDirectory unless currentWorkingDirectory == "".
- */
-std::string makeAbsolutePath(const std::string &currentWorkingDirectory,
-                             std::string path) {
-  llvm::SmallVector<char, 16> result;
-  std::vector<std::string> elements;
-  int skip = 0;
+void normalizePath(llvm::SmallVectorImpl<char> &path) {
+  char *p = path.data();
+  size_t size = path.size();
+  bool isAbsolute = size > 0 && p[0] == '/';
+  // the normalized path is written in p[0, out), which never overtakes the
+  // element being read
+  size_t out = isAbsolute ? 1 : 0;
+  // offsets where the elements written so far start, separator included
+  llvm::SmallVector<size_t, 32> starts;
+  // number of leading ".." kept, at the bottom of starts
+  size_t keptParents = 0;
+  size_t i = out;
+  while (i < size) {
+    if (p[i] == '/') {
+      i++;
+      continue;
+    }
+    size_t end = i;
+    while (end < size && p[end] != '/') {
+      end++;
+    }
+    llvm::StringRef element(p + i, end - i);
+    if (element == ".") {
+      // skip
+    } else if (element == ".." && starts.size() > keptParents) {
+      out = starts.back();
+      starts.pop_back();
+    } else if (element == ".." && isAbsolute) {
+      // the parent of the root is the root
+    } else {
+      if (element == "..") {
+        keptParents++;
+      }
+      starts.push_back(out);
+      if (out > 0 && p[out - 1] != '/') {
+        p[out++] = '/';
+      }
+      memmove(p + out, p + i, end - i);
+      out += end - i;
+    }
+    i = end;
+  }
+  path.resize(out);
+}
 
+void makeAbsolutePath(llvm::StringRef currentWorkingDirectory,
+                      llvm::StringRef path,
+                      llvm::SmallVectorImpl<char> &result) {
+  result.clear();
   if (llvm::sys::path::is_relative(path)) {
     // Prepend currentWorkingDirectory to path (unless currentWorkingDirectory
     // is empty).
-    llvm::SmallVector<char, 16> vec(currentWorkingDirectory.begin(),
-                                    currentWorkingDirectory.end());
-    llvm::sys::path::append(vec, path);
-    path = std::string(vec.begin(), vec.end());
+    result.append(currentWorkingDirectory.begin(),
+                  currentWorkingDirectory.end());
+    llvm::sys::path::append(result, path);
   } else {
-    // Else copy the separator to maintain an absolute path.
-    result.append(1, path.front());
+    result.append(path.begin(), path.end());
   }
+  normalizePath(result);
+}
 
-  elements.push_back(llvm::sys::path::filename(path));
+std::string makeAbsolutePath(const std::string &currentWorkingDirectory,
+                             std::string path) {
+  llvm::SmallString<256> result;
+  makeAbsolutePath(currentWorkingDirectory, path, result);
+  return result.str();
+}
 
-  while (llvm::sys::path::has_parent_path(path)) {
-    path = llvm::sys::path::parent_path(path);
-    const std::string &element(llvm::sys::path::filename(path));
-    if (element == ".") {
-      continue;
-    }
-    if (element == "..") {
-      skip++;
-      continue;
-    }
-    if (skip > 0) {
-      skip--;
-      continue;
+RelativePathRoots::RelativePathRoots(const std::string &repoRoot,
+                                     const std::string &sysRoot,
+                                     bool allowSiblingsToRepoRoot) {
+  if (repoRoot != "") {
+    this->repoRoot = repoRoot + "/";
+    if (allowSiblingsToRepoRoot) {
+      parentOfRepoRoot =
+          llvm::sys::path::parent_path(repoRoot).str() + "/";
     }
-    elements.push_back(element);
-  }
-  while (skip > 0) {
-    elements.push_back("..");
-    skip--;
   }
-
-  for (auto I = elements.rbegin(), E = elements.rend(); I != E; I++) {
-    llvm::sys::path::append(result, *I);
+  if (sysRoot != "") {
+    this->sysRoot = sysRoot + "/";
   }
-  return std::string(result.begin(), result.end());
 }
 
-std::string makeRelativePath(const std::string &repoRoot,
-                             const std::string &sysRoot,
+std::string makeRelativePath(const RelativePathRoots &roots,
                              bool keepExternalPaths,
-                             bool allowSiblingsToRepoRoot,
-                             const std::string &path) {
-  if (repoRoot != "") {
-    if (llvm::StringRef(path).startswith(repoRoot + "/")) {
-      return path.substr(repoRoot.size() + 1);
-    }
-    if (allowSiblingsToRepoRoot) {
-      std::string parentOfRoot = llvm::sys::path::parent_path(repoRoot);
-      if (llvm::StringRef(path).startswith(parentOfRoot + "/")) {
-        return "../" + path.substr(parentOfRoot.size() + 1);
-      }
-    }
+                             llvm::StringRef path) {
+  if (!roots.repoRoot.empty() && path.startswith(roots.repoRoot)) {
+    return path.substr(roots.repoRoot.size());
+  }
+  if (!roots.parentOfRepoRoot.empty() &&
+      path.startswith(roots.parentOfRepoRoot)) {
+    return "../" + path.substr(roots.parentOfRepoRoot.size()).str();
   }
-  if (sysRoot != "" && llvm::StringRef(path).startswith(sysRoot + "/")) {
+  if (!roots.sysRoot.empty() && path.startswith(roots.sysRoot)) {
     // Intentionally keep the heading "/" in this case.
-    return path.substr(sysRoot.size());
+    return path.substr(roots.sysRoot.size() - 1);
   }
   if (keepExternalPaths) {
     return path;
@@ -92,4 +117,15 @@ std::string makeRelativePath(const std::string &repoRoot,
   return "";
 }
 
+std::string makeRelativePath(const std::string &repoRoot,
+                             const std::string &sysRoot,
+                             bool keepExternalPaths,
+                             bool allowSiblingsToRepoRoot,
+                             const std::string &path) {
+  return makeRelativePath(
+      RelativePathRoots(repoRoot, sysRoot, allowSiblingsToRepoRoot),
+      keepExternalPaths,
+      path);
+}
+
 } // namespace FileUtils
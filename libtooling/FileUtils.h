@@ -8,23 +8,55 @@
 #pragma once
 
 #include <clang/AST/Decl.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
 #include <string>
 
 namespace FileUtils {
 
+/**
+ * Simplify away "." and ".." elements and repeated separators, in place and
+ * in a single pass. Leading ".." elements of a relative path are kept, the
+ * ones going above the root of an absolute path are dropped.
+ */
+void normalizePath(llvm::SmallVectorImpl<char> &path);
+
 /**
  * Simplify away "." and ".." elements.
  * If pathToNormalize is a relative path, it will be pre-pended with
  * currentWorkingDirectory unless currentWorkingDirectory == "".
  */
+void makeAbsolutePath(llvm::StringRef currentWorkingDirectory,
+                      llvm::StringRef path,
+                      llvm::SmallVectorImpl<char> &result);
 std::string makeAbsolutePath(const std::string &currentWorkingDirectory,
                              std::string path);
 
+/**
+ * Prefixes removed by makeRelativePath, computed once.
+ */
+struct RelativePathRoots {
+  // "repoRoot/", or empty
+  std::string repoRoot;
+  // "parentOfRepoRoot/" when siblings to the repo root are allowed, or empty
+  std::string parentOfRepoRoot;
+  // "sysRoot/", or empty
+  std::string sysRoot;
+
+  RelativePathRoots() {}
+  RelativePathRoots(const std::string &repoRoot,
+                    const std::string &sysRoot,
+                    bool allowSiblingsToRoot);
+};
+
 /**
  * Try to delete a prefix "repoRoot/" OR "sysRoot" from the given absolute path.
  * If no rule applies AND keepExternalPaths is true, return the same path,
  * otherwise return the empty string.
  */
+std::string makeRelativePath(const RelativePathRoots &roots,
+                             bool keepExternalPaths,
+                             llvm::StringRef path);
 std::string makeRelativePath(const std::string &repoRoot,
                              const std::string &sysRoot,
                              bool keepExternalPaths,
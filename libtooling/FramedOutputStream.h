@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace ASTLib {
+
+// Stream writing its output as a sequence of frames, each one prefixed with
+// its length as a 32-bit big-endian integer. The content of a frame is kept
+// in memory until endFrame() is called. Pending content is written as a last
+// frame on destruction.
+class FramedOutputStream : public llvm::raw_ostream {
+  llvm::raw_ostream &OS;
+  llvm::SmallVector<char, 0> Frame;
+  uint64_t Pos;
+  // number of bytes written to OS
+  uint64_t Offset;
+
+  void write_impl(const char *Ptr, size_t Size) override {
+    Frame.append(Ptr, Ptr + Size);
+    Pos += Size;
+  }
+  uint64_t current_pos() const override {
+    return Pos;
+  }
+
+ public:
+  explicit FramedOutputStream(llvm::raw_ostream &OS)
+      : OS(OS), Pos(0), Offset(0) {}
+  ~FramedOutputStream() override {
+    endFrame();
+  }
+
+  // offset in the output of the current frame
+  uint64_t frameOffset() const {
+    return Offset;
+  }
+
+  void writeUInt32(uint32_t X) {
+    const char Bytes[] = {(char)(X >> 24), (char)(X >> 16), (char)(X >> 8),
+                          (char)X};
+    write(Bytes, sizeof(Bytes));
+  }
+
+  void writeUInt64(uint64_t X) {
+    writeUInt32(X >> 32);
+    writeUInt32(X);
+  }
+
+  // content of the current frame
+  llvm::StringRef frame() {
+    flush();
+    return llvm::StringRef(Frame.data(), Frame.size());
+  }
+
+  // replaces the content of the current frame, see DeclStore
+  void replaceFrame(llvm::StringRef Content) {
+    flush();
+    Frame.assign(Content.begin(), Content.end());
+  }
+
+  void endFrame() {
+    flush();
+    if (Frame.empty()) {
+      return;
+    }
+    assert(Frame.size() <= UINT32_MAX);
+    uint32_t Size = Frame.size();
+    const char Header[] = {(char)(Size >> 24),
+                           (char)(Size >> 16),
+                           (char)(Size >> 8),
+                           (char)Size};
+    OS.write(Header, sizeof(Header));
+    OS.write(Frame.data(), Frame.size());
+    Offset += sizeof(Header) + Frame.size();
+    Frame.clear();
+  }
+};
+
+} // end of namespace ASTLib
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include <llvm/Support/raw_ostream.h>
+#include <zlib.h>
+
+// zconf.h defines OF for old compilers, ASTExporter uses it as a name
+#undef OF
+
+namespace ASTLib {
+
+// Stream compressing its output in the gzip format. The compressed stream is
+// completed on destruction. If zlib fails, the error is reported once and the
+// rest of the output is dropped, see has_error.
+class GzipOutputStream : public llvm::raw_ostream {
+  llvm::raw_ostream &OS;
+  z_stream Z;
+  uint64_t Pos;
+  bool Failed;
+  char Out[1 << 16];
+
+  void fail(const char *Function, int Code) {
+    llvm::errs() << "GzipOutputStream: " << Function
+                 << " failed: " << (Z.msg ? Z.msg : zError(Code)) << "\n";
+    Failed = true;
+  }
+
+  void deflateBuffer(const char *Ptr, size_t Size, int Flush) {
+    if (Failed) {
+      return;
+    }
+    do {
+      // avail_in is 32 bits wide
+      uInt Chunk = std::min<size_t>(Size, UINT32_MAX);
+      // deflate does not write to its input
+      Z.next_in = (Bytef *)const_cast<char *>(Ptr);
+      Z.avail_in = Chunk;
+      Ptr += Chunk;
+      Size -= Chunk;
+      int ChunkFlush = Size ? Z_NO_FLUSH : Flush;
+      do {
+        Z.next_out = (Bytef *)Out;
+        Z.avail_out = sizeof(Out);
+        // Z_BUF_ERROR only means that no progress was possible
+        int Result = deflate(&Z, ChunkFlush);
+        if (Result != Z_OK && Result != Z_STREAM_END &&
+            Result != Z_BUF_ERROR) {
+          fail("deflate", Result);
+          return;
+        }
+        OS.write(Out, sizeof(Out) - Z.avail_out);
+      } while (Z.avail_out == 0);
+    } while (Size);
+  }
+
+  void write_impl(const char *Ptr, size_t Size) override {
+    deflateBuffer(Ptr, Size, Z_NO_FLUSH);
+    Pos += Size;
+  }
+  uint64_t current_pos() const override {
+    return Pos;
+  }
+
+ public:
+  explicit GzipOutputStream(llvm::raw_ostream &OS)
+      : OS(OS), Pos(0), Failed(false) {
+    Z.zalloc = Z_NULL;
+    Z.zfree = Z_NULL;
+    Z.opaque = Z_NULL;
+    Z.msg = Z_NULL;
+    // deflateEnd ignores a stream that failed to initialize
+    Z.state = Z_NULL;
+    // 16 + the default window size selects the gzip format
+    int Result = deflateInit2(&Z,
+                              Z_DEFAULT_COMPRESSION,
+                              Z_DEFLATED,
+                              16 + MAX_WBITS,
+                              8,
+                              Z_DEFAULT_STRATEGY);
+    if (Result != Z_OK) {
+      fail("deflateInit2", Result);
+    }
+    SetBufferSize(sizeof(Out));
+  }
+  ~GzipOutputStream() override {
+    flush();
+    deflateBuffer(nullptr, 0, Z_FINISH);
+    deflateEnd(&Z);
+    OS.flush();
+  }
+
+  // Whether the compressed output is incomplete
+  bool has_error() const {
+    return Failed;
+  }
+};
+
+} // end of namespace ASTLib
@@ -8,62 +8,103 @@
 #pragma once
 #include <clang/AST/DeclVisitor.h>
 #include <clang/Basic/SourceManager.h>
+#include <llvm/ADT/DenseMap.h>
 
+#include "PresumedLocCache.h"
 #include "atdlib/ATDWriter.h"
 namespace ASTLib {
 
 using namespace clang;
 template <class ATDWriter>
-class NamePrinter : public ConstDeclVisitor<NamePrinter<ATDWriter>> {
+class NamePrinter
+    : public ConstDeclVisitor<NamePrinter<ATDWriter>, std::string> {
   typedef typename ATDWriter::ObjectScope ObjectScope;
   typedef typename ATDWriter::ArrayScope ArrayScope;
   typedef typename ATDWriter::TupleScope TupleScope;
   typedef typename ATDWriter::VariantScope VariantScope;
 
-  const SourceManager &SM;
+  PresumedLocCache &LocCache;
   ATDWriter &OF;
+  const PrintingPolicy Policy;
 
-  PrintingPolicy getPrintingPolicy();
+  // Components of qualified names, each decl is printed once
+  llvm::DenseMap<const Decl *, std::string> Components;
+
+  static PrintingPolicy getPrintingPolicy();
   void printTemplateArgList(llvm::raw_ostream &OS,
                             const ArrayRef<TemplateArgument> Args);
+  const std::string &getComponent(const Decl *D);
 
  public:
-  NamePrinter(const SourceManager &SM, ATDWriter &OF) : SM(SM), OF(OF) {}
+  NamePrinter(PresumedLocCache &LocCache, ATDWriter &OF)
+      : LocCache(LocCache), OF(OF), Policy(getPrintingPolicy()) {}
 
   // implementation is inspired by NamedDecl::printQualifiedName
   // but with better handling for anonymous structs,unions and namespaces
   void printDeclName(const NamedDecl &D);
 
-  void VisitNamedDecl(const NamedDecl *D);
-  void VisitNamespaceDecl(const NamespaceDecl *ND);
-  void VisitTagDecl(const TagDecl *TD);
-  void VisitFunctionDecl(const FunctionDecl *FD);
+  std::string VisitNamedDecl(const NamedDecl *D);
+  std::string VisitNamespaceDecl(const NamespaceDecl *ND);
+  std::string VisitTagDecl(const TagDecl *TD);
+  std::string VisitFunctionDecl(const FunctionDecl *FD);
 };
 
 // 64 bits fnv-1a
 const uint64_t FNV64_hash_start = 14695981039346656037ULL;
 const uint64_t FNV64_prime = 1099511628211ULL;
-uint64_t fnv64Hash(const char *s, int n) {
-  uint64_t hash = FNV64_hash_start;
-  for (int i = 0; i < n; ++i) {
+inline uint64_t fnv64Hash(uint64_t hash, const char *s, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
     hash ^= s[i];
     hash *= FNV64_prime;
   }
   return hash;
 }
 
+uint64_t fnv64Hash(const char *s, int n) {
+  return fnv64Hash(FNV64_hash_start, s, n);
+}
+
 uint64_t fnv64Hash(llvm::raw_svector_ostream &OS) {
-  std::string s = OS.str();
+  StringRef s = OS.str();
   return fnv64Hash(s.data(), s.size());
 }
 
+// Stream computing the fnv64Hash of everything written to it, without
+// keeping the text around. Used to hash names straight out of the mangler.
+class FNV64HashStream : public llvm::raw_ostream {
+  uint64_t Hash;
+  uint64_t Pos;
+  char Buffer[256];
+
+  void write_impl(const char *Ptr, size_t Size) override {
+    Hash = fnv64Hash(Hash, Ptr, Size);
+    Pos += Size;
+  }
+  uint64_t current_pos() const override {
+    return Pos;
+  }
+
+ public:
+  FNV64HashStream() : Hash(FNV64_hash_start), Pos(0) {
+    SetBuffer(Buffer, sizeof(Buffer));
+  }
+  ~FNV64HashStream() override {
+    flush();
+  }
+
+  uint64_t hash() {
+    flush();
+    return Hash;
+  }
+};
+
 const int templateLengthThreshold = 40;
 template <class ATDWriter>
 void NamePrinter<ATDWriter>::printTemplateArgList(
     llvm::raw_ostream &OS, const ArrayRef<TemplateArgument> Args) {
   SmallString<64> Buf;
   llvm::raw_svector_ostream tmpOS(Buf);
-  clang::printTemplateArgumentList(tmpOS, Args, getPrintingPolicy());
+  clang::printTemplateArgumentList(tmpOS, Args, Policy);
   if (tmpOS.str().size() > templateLengthThreshold) {
     OS << "<";
     OS.write_hex(fnv64Hash(tmpOS));
@@ -103,32 +144,44 @@ void NamePrinter<ATDWriter>::printDeclName(const NamedDecl &D) {
   ArrayScope aScope(OF, Contexts.size());
   // dump list in reverse
   for (const Decl *Ctx : Contexts) {
-    ConstDeclVisitor<NamePrinter<ATDWriter>>::Visit(Ctx);
+    OF.emitString(getComponent(Ctx));
+  }
+}
+
+template <class ATDWriter>
+const std::string &NamePrinter<ATDWriter>::getComponent(const Decl *D) {
+  auto I = Components.find(D);
+  if (I != Components.end()) {
+    return I->second;
   }
+  std::string Component =
+      ConstDeclVisitor<NamePrinter<ATDWriter>, std::string>::Visit(D);
+  return Components[D] = std::move(Component);
 }
 
 template <class ATDWriter>
-void NamePrinter<ATDWriter>::VisitNamedDecl(const NamedDecl *D) {
-  OF.emitString(D->getNameAsString());
+std::string NamePrinter<ATDWriter>::VisitNamedDecl(const NamedDecl *D) {
+  return D->getNameAsString();
 }
 
 template <class ATDWriter>
-void NamePrinter<ATDWriter>::VisitNamespaceDecl(const NamespaceDecl *ND) {
+std::string NamePrinter<ATDWriter>::VisitNamespaceDecl(
+    const NamespaceDecl *ND) {
   if (ND->isAnonymousNamespace()) {
-    PresumedLoc PLoc = SM.getPresumedLoc(ND->getLocation());
+    PresumedLoc PLoc = LocCache.getPresumedLoc(ND->getLocation());
     std::string file = "invalid_loc";
     if (PLoc.isValid()) {
       file = PLoc.getFilename();
     }
-    OF.emitString("anonymous_namespace_" + file);
+    return "anonymous_namespace_" + file;
   } else {
     // for non-anonymous namespaces, fallback to normal behavior
-    VisitNamedDecl(ND);
+    return VisitNamedDecl(ND);
   }
 }
 
 template <class ATDWriter>
-void NamePrinter<ATDWriter>::VisitTagDecl(const TagDecl *D) {
+std::string NamePrinter<ATDWriter>::VisitTagDecl(const TagDecl *D) {
   // heavily inspired by clang's TypePrinter::printTag() function
   SmallString<64> Buf;
   llvm::raw_svector_ostream StrOS(Buf);
@@ -142,7 +195,7 @@ void NamePrinter<ATDWriter>::VisitTagDecl(const TagDecl *D) {
     } else {
       StrOS << "anonymous_" << D->getKindName();
     }
-    PresumedLoc PLoc = SM.getPresumedLoc(D->getLocation());
+    PresumedLoc PLoc = LocCache.getPresumedLoc(D->getLocation());
     if (PLoc.isValid()) {
       StrOS << "_" << PLoc.getFilename() << ':' << PLoc.getLine() << ':'
             << PLoc.getColumn();
@@ -155,11 +208,12 @@ void NamePrinter<ATDWriter>::VisitTagDecl(const TagDecl *D) {
     Args = TemplateArgs.asArray();
     printTemplateArgList(StrOS, Args);
   }
-  OF.emitString(StrOS.str());
+  return StrOS.str();
 }
 
 template <class ATDWriter>
-void NamePrinter<ATDWriter>::VisitFunctionDecl(const FunctionDecl *FD) {
+std::string NamePrinter<ATDWriter>::VisitFunctionDecl(
+    const FunctionDecl *FD) {
   std::string template_str = "";
   // add instantiated template arguments for readability
   if (const TemplateArgumentList *TemplateArgs =
@@ -169,7 +223,7 @@ void NamePrinter<ATDWriter>::VisitFunctionDecl(const FunctionDecl *FD) {
     printTemplateArgList(StrOS, TemplateArgs->asArray());
     template_str = StrOS.str();
   }
-  OF.emitString(FD->getNameAsString() + template_str);
+  return FD->getNameAsString() + template_str;
 }
 
 template <class ATDWriter>
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <clang/Basic/SourceManager.h>
+#include <llvm/ADT/DenseMap.h>
+
+#include "SimplePluginASTAction.h"
+
+namespace ASTLib {
+
+using namespace clang;
+
+// Drop-in replacement for SourceManager::getPresumedLoc, caching per FileID
+// the file name, its normalized path and the table of line offsets. Once a
+// file has been seen, locations in the same file are resolved with a bounds
+// check and a binary search in the line table.
+// Files with #line directives are not cached.
+class PresumedLocCache {
+  struct FileInfo {
+    bool IsCached;
+    FileID FID;
+    // offsets of the file in the SourceManager: [Start, Start + Size]
+    unsigned Start;
+    unsigned Size;
+    const char *Filename;
+    const std::string *NormalizedPath;
+    SourceLocation IncludeLoc;
+    // owned by the SourceManager
+    const char *Buffer;
+    const unsigned *LineStarts;
+    unsigned NumLines;
+  };
+
+  const SourceManager &SM;
+  const ASTPluginLib::PluginASTOptionsBase &Options;
+  std::vector<FileInfo> Files;
+  llvm::DenseMap<FileID, unsigned> FileIndex;
+  // index in Files of the last file looked up, or Files.size()
+  unsigned LastFile;
+
+  const FileInfo &lookupFile(FileID FID, SourceLocation Loc) {
+    auto I = FileIndex.find(FID);
+    if (I != FileIndex.end()) {
+      return Files[I->second];
+    }
+    FileIndex[FID] = Files.size();
+    Files.emplace_back();
+    FileInfo &FI = Files.back();
+    FI.IsCached = false;
+    FI.FID = FID;
+    bool Invalid = false;
+    const SrcMgr::SLocEntry &Entry = SM.getSLocEntry(FID, &Invalid);
+    if (Invalid || !Entry.isFile() || Entry.getFile().hasLineDirectives()) {
+      return FI;
+    }
+    // the first query computes the line table of the file if needed
+    PresumedLoc PLoc = SM.getPresumedLoc(Loc);
+    StringRef Data = SM.getBufferData(FID, &Invalid);
+    const SrcMgr::ContentCache *Content = Entry.getFile().getContentCache();
+    if (PLoc.isInvalid() || Invalid || !Content->SourceLineCache) {
+      return FI;
+    }
+    FI.IsCached = true;
+    FI.Start = Entry.getOffset();
+    FI.Size = SM.getFileIDSize(FID);
+    FI.Filename = PLoc.getFilename();
+    FI.NormalizedPath = nullptr;
+    FI.IncludeLoc = PLoc.getIncludeLoc();
+    FI.Buffer = Data.data();
+    FI.LineStarts = Content->SourceLineCache;
+    FI.NumLines = Content->NumLines;
+    return FI;
+  }
+
+  // Same computation as SourceManager::getColumnNumber
+  static unsigned getColumn(const FileInfo &FI, unsigned FilePos,
+                            unsigned Line) {
+    if (Line < FI.NumLines) {
+      unsigned LineStart = FI.LineStarts[Line - 1];
+      unsigned LineEnd = FI.LineStarts[Line];
+      if (FilePos + 1 == LineEnd && FilePos > LineStart &&
+          (FI.Buffer[FilePos - 1] == '\r' || FI.Buffer[FilePos - 1] == '\n')) {
+        --FilePos;
+      }
+      return FilePos - LineStart + 1;
+    }
+    unsigned LineStart = FilePos;
+    while (LineStart && FI.Buffer[LineStart - 1] != '\n' &&
+           FI.Buffer[LineStart - 1] != '\r') {
+      --LineStart;
+    }
+    return FilePos - LineStart + 1;
+  }
+
+ public:
+  PresumedLocCache(const SourceManager &SM,
+                   const ASTPluginLib::PluginASTOptionsBase &Options)
+      : SM(SM), Options(Options), LastFile(0) {}
+
+  PresumedLoc getPresumedLoc(SourceLocation Loc) {
+    if (Loc.isInvalid()) {
+      return PresumedLoc();
+    }
+    // presumed locations are always for expansion points
+    Loc = SM.getExpansionLoc(Loc);
+    // raw encodings of file locations are their offsets
+    unsigned Offset = Loc.getRawEncoding();
+    if (LastFile >= Files.size() || !Files[LastFile].IsCached ||
+        Offset - Files[LastFile].Start > Files[LastFile].Size) {
+      FileID FID = SM.getFileID(Loc);
+      const FileInfo &FI = lookupFile(FID, Loc);
+      LastFile = &FI - Files.data();
+      if (!FI.IsCached) {
+        return SM.getPresumedLoc(Loc);
+      }
+    }
+    const FileInfo &FI = Files[LastFile];
+    unsigned FilePos = Offset - FI.Start;
+    unsigned Line =
+        std::upper_bound(FI.LineStarts, FI.LineStarts + FI.NumLines, FilePos) -
+        FI.LineStarts;
+    return PresumedLoc(FI.Filename,
+                       FI.FID,
+                       Line,
+                       getColumn(FI, FilePos, Line),
+                       FI.IncludeLoc);
+  }
+
+  // Same as Options.normalizeSourcePath(PLoc.getFilename()), without
+  // hashing the filename for cached files
+  const std::string &getNormalizedPath(const PresumedLoc &PLoc) {
+    auto I = FileIndex.find(PLoc.getFileID());
+    if (I != FileIndex.end()) {
+      FileInfo &FI = Files[I->second];
+      if (FI.IsCached && FI.Filename == PLoc.getFilename()) {
+        if (!FI.NormalizedPath) {
+          FI.NormalizedPath = &Options.normalizeSourcePath(FI.Filename);
+        }
+        return *FI.NormalizedPath;
+      }
+    }
+    return Options.normalizeSourcePath(PLoc.getFilename());
+  }
+};
+
+} // end of namespace ASTLib
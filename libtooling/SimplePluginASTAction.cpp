@@ -5,15 +5,25 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <errno.h>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <unordered_map>
 
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include "FileUtils.h"
 #include "SimplePluginASTAction.h"
@@ -102,8 +112,6 @@ bool PluginASTOptionsBase::loadUnsignedInt(const argmap_t &map,
 }
 
 void PluginASTOptionsBase::loadValuesFromEnvAndMap(const argmap_t map) {
-  bool needBasePath = false;
-
   loadBool(map, "ALLOW_SIBLINGS_TO_REPO_ROOT", allowSiblingsToRepoRoot);
   loadBool(map, "KEEP_EXTERNAL_PATHS", keepExternalPaths);
   loadString(map, "MAKE_RELATIVE_TO", repoRoot);
@@ -112,18 +120,12 @@ void PluginASTOptionsBase::loadValuesFromEnvAndMap(const argmap_t map) {
   // Possibly override the first argument given on the command line.
   loadString(map, "OUTPUT_FILE", outputFile);
 
-  loadBool(map, "PREPEND_CURRENT_DIR", needBasePath);
+  loadBool(map, "PREPEND_CURRENT_DIR", prependCurrentDir);
   loadBool(map, "RESOLVE_SYMLINKS", resolveSymlinks);
   loadString(map, "STRIP_ISYSROOT", iSysRoot);
 
-  if (needBasePath) {
-    llvm::SmallString<1024> CurrentDir;
-    if (llvm::sys::fs::current_path(CurrentDir)) {
-      llvm::errs() << "Failed to retrieve current working directory\n";
-    } else {
-      basePath = CurrentDir.str();
-    }
-  }
+  relativePathRoots = FileUtils::RelativePathRoots(
+      repoRoot, iSysRoot, allowSiblingsToRepoRoot);
 }
 
 void PluginASTOptionsBase::setObjectFile(const std::string &path) {
@@ -133,6 +135,22 @@ void PluginASTOptionsBase::setObjectFile(const std::string &path) {
   }
 }
 
+void PluginASTOptionsBase::setWorkingDirectory(clang::CompilerInstance &CI) {
+  if (!prependCurrentDir) {
+    return;
+  }
+  llvm::ErrorOr<std::string> CurrentDir =
+      CI.getFileManager().getVirtualFileSystem().getCurrentWorkingDirectory();
+  if (!CurrentDir) {
+    llvm::errs() << "Failed to retrieve current working directory\n";
+    basePath = "";
+  } else {
+    basePath = *CurrentDir;
+  }
+  // paths normalized against another directory
+  normalizationCache->clear();
+}
+
 /**
  * Expects an immutable string on the heap as an argument
  * (e.g. a path extracted from a node in the AST)
@@ -150,25 +168,22 @@ const std::string &PluginASTOptionsBase::normalizeSourcePath(
     result = path;
     return result;
   }
-  std::string absPath = FileUtils::makeAbsolutePath(basePath, path);
+  llvm::SmallString<1024> absPath;
+  FileUtils::makeAbsolutePath(basePath, path, absPath);
   if (resolveSymlinks) {
     // if realPath is a symlink, resolve it
     char buf[2048];
     int len = readlink(absPath.c_str(), buf, sizeof(buf) - 1);
     if (len != -1) {
-      buf[len] = '\0';
-      absPath = buf;
+      absPath.assign(buf, buf + len);
     }
   }
   // By convention, relative paths are only activated when repoRoot != "".
   if (repoRoot != "") {
-    result = FileUtils::makeRelativePath(repoRoot,
-                                         iSysRoot,
-                                         keepExternalPaths,
-                                         allowSiblingsToRepoRoot,
-                                         absPath);
+    result = FileUtils::makeRelativePath(
+        relativePathRoots, keepExternalPaths, absPath);
   } else {
-    result = absPath;
+    result = absPath.str();
   }
   return result;
 }
@@ -177,4 +192,148 @@ const std::string &PluginASTOptionsBase::normalizeSourcePath(
     llvm::StringRef path) const {
   return normalizeSourcePath(path.data());
 }
+
+namespace {
+
+// sizes of the stream outputs written in full, see closedStreamOutputSize
+std::mutex closedStreamOutputsMutex;
+llvm::StringMap<uint64_t> closedStreamOutputs;
+
+// Blocks SIGPIPE in the current thread for its lifetime, so that writing to a
+// pipe or a socket closed by the consumer fails with EPIPE instead of killing
+// the compiler. The plugin does not own the signal dispositions of the
+// process, hence the mask rather than SIG_IGN. A SIGPIPE raised meanwhile is
+// discarded, unless one was already pending.
+class SigpipeBlocker {
+  sigset_t sigpipe;
+  sigset_t oldMask;
+  bool wasPending;
+
+  static bool isPending() {
+    sigset_t pending;
+    return sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE) == 1;
+  }
+
+ public:
+  SigpipeBlocker() {
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    wasPending = isPending();
+    pthread_sigmask(SIG_BLOCK, &sigpipe, &oldMask);
+  }
+  ~SigpipeBlocker() {
+    if (!wasPending && isPending()) {
+      // returns at once since the signal is pending
+      int sig;
+      sigwait(&sigpipe, &sig);
+    }
+    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+  }
+};
+
+// Unlike raw_fd_ostream, a failed write is not fatal, as the consumer may go
+// away at any time: it is reported once, and the rest of the output is
+// dropped.
+class StreamOutput : public llvm::raw_ostream {
+  int fd;
+  bool shouldClose;
+  bool failed;
+  uint64_t pos;
+  std::string name;
+
+  void write_impl(const char *ptr, size_t size) override {
+    pos += size;
+    if (failed) {
+      return;
+    }
+    SigpipeBlocker blocker;
+    while (size > 0 && !failed) {
+      ssize_t n = ::write(fd, ptr, size);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        // read before errs() may change it
+        int error = errno;
+        failed = true;
+        llvm::errs() << "Failed to write to " << name << ": "
+                     << strerror(error) << "\n";
+        return;
+      }
+      ptr += n;
+      size -= n;
+    }
+  }
+  uint64_t current_pos() const override {
+    return pos;
+  }
+
+ public:
+  StreamOutput(int fd, bool shouldClose, llvm::StringRef name)
+      : fd(fd), shouldClose(shouldClose), failed(false), pos(0), name(name) {}
+  ~StreamOutput() override {
+    flush();
+    if (shouldClose) {
+      ::close(fd);
+    }
+    std::lock_guard<std::mutex> lock(closedStreamOutputsMutex);
+    if (failed) {
+      closedStreamOutputs.erase(name);
+    } else {
+      closedStreamOutputs[name] = pos;
+    }
+  }
+};
+
+} // namespace
+
+bool isStreamOutput(llvm::StringRef outputFile) {
+  return outputFile.startswith("fd:") || outputFile.startswith("unix:");
+}
+
+bool closedStreamOutputSize(llvm::StringRef outputFile, uint64_t &size) {
+  std::lock_guard<std::mutex> lock(closedStreamOutputsMutex);
+  auto it = closedStreamOutputs.find(outputFile);
+  if (it == closedStreamOutputs.end()) {
+    return false;
+  }
+  size = it->second;
+  closedStreamOutputs.erase(it);
+  return true;
+}
+
+std::unique_ptr<llvm::raw_ostream> openStreamOutput(
+    llvm::StringRef outputFile) {
+  int fd;
+  if (outputFile.startswith("fd:")) {
+    if (outputFile.substr(3).getAsInteger(10, fd) || fd < 0) {
+      llvm::errs() << "Invalid output file descriptor: " << outputFile << "\n";
+      return nullptr;
+    }
+    // the descriptor belongs to the caller, who closes it
+    return std::unique_ptr<llvm::raw_ostream>(
+        new StreamOutput(fd, /*shouldClose=*/false, outputFile));
+  }
+  llvm::StringRef path = outputFile.substr(5);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    llvm::errs() << "Invalid output socket path: " << outputFile << "\n";
+    return nullptr;
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    int error = errno;
+    llvm::errs() << "Cannot connect to the output socket " << path << ": "
+                 << strerror(error) << "\n";
+    if (fd >= 0) {
+      close(fd);
+    }
+    return nullptr;
+  }
+  return std::unique_ptr<llvm::raw_ostream>(
+      new StreamOutput(fd, /*shouldClose=*/true, outputFile));
+}
 } // namespace ASTPluginLib
@@ -36,6 +36,9 @@ struct PluginASTOptionsBase {
    * The intention is to make file paths in the AST absolute if needed.
    */
   std::string basePath;
+  /* Whether PREPEND_CURRENT_DIR was specified. basePath is the working
+   * directory of the compiler, set by setWorkingDirectory. */
+  bool prependCurrentDir = false;
 
   /* Configure a second pass on file paths to make them relative to the repo
    * root. */
@@ -66,6 +69,8 @@ struct PluginASTOptionsBase {
   /* cache for normalizeSourcePath */
   std::unique_ptr<std::unordered_map<const char *, std::string>>
       normalizationCache;
+  /* prefixes of repoRoot and iSysRoot, set by loadValuesFromEnvAndMap */
+  FileUtils::RelativePathRoots relativePathRoots;
 
  protected:
   static const std::string envPrefix;
@@ -94,10 +99,26 @@ struct PluginASTOptionsBase {
   // the output file in case a pattern "%.bla" was given.
   void setObjectFile(const std::string &path);
 
+  // Sets basePath if PREPEND_CURRENT_DIR was given. Tools may give each
+  // compiler a file system with its own working directory, distinct from the
+  // one of the process (see ast_exporter_bin -j).
+  void setWorkingDirectory(clang::CompilerInstance &CI);
+
   const std::string &normalizeSourcePath(const char *path) const;
   const std::string &normalizeSourcePath(llvm::StringRef path) const;
 };
 
+// Outputs named fd:N or unix:PATH are streamed to the file descriptor N or
+// to the Unix domain socket PATH, as they are written and without a temporary
+// file, so that a consumer process can read them directly. Writes block when
+// the consumer lags behind. The file descriptor N is left open.
+bool isStreamOutput(llvm::StringRef outputFile);
+// Returns null, after printing an error, if the output cannot be opened.
+std::unique_ptr<llvm::raw_ostream> openStreamOutput(llvm::StringRef outputFile);
+// Whether the stream output outputFile was closed since the last call, with
+// all its writes successful, and if so how many bytes were written to it.
+bool closedStreamOutputSize(llvm::StringRef outputFile, uint64_t &size);
+
 struct EmptyPreprocessorHandlerData {};
 
 struct EmptyPreprocessorHandler : public clang::PPCallbacks {
@@ -169,6 +190,7 @@ class SimplePluginASTActionBase : public clang::PluginASTAction {
     }
     options->inputFile = inputFile;
     options->setObjectFile(CI.getFrontendOpts().OutputFile);
+    options->setWorkingDirectory(CI);
     // success
     return true;
   }
@@ -215,14 +237,17 @@ class SimplePluginASTAction
     if (!Parent::SetFileOptions(CI, inputFilename)) {
       return nullptr;
     }
+    const std::string &outputFile = Parent::options->outputFile;
     std::unique_ptr<llvm::raw_ostream> OS =
-        CI.createOutputFile(Parent::options->outputFile,
-                            Binary,
-                            RemoveFileOnSignal,
-                            "",
-                            "",
-                            UseTemporary,
-                            CreateMissingDirectories);
+        isStreamOutput(outputFile)
+            ? openStreamOutput(outputFile)
+            : CI.createOutputFile(outputFile,
+                                  Binary,
+                                  RemoveFileOnSignal,
+                                  "",
+                                  "",
+                                  UseTemporary,
+                                  CreateMissingDirectories);
     if (!OS) {
       return nullptr;
     }
@@ -10,10 +10,30 @@
  * while conforming to the inlined ATD specifications.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <errno.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
 #include "ASTExporter.h"
 
+#include <clang/Basic/FileManager.h>
+#include <clang/Frontend/CompilerInvocation.h>
 #include <clang/Tooling/CommonOptionsParser.h>
 #include <clang/Tooling/Tooling.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/VirtualFileSystem.h>
 
 //===----------------------------------------------------------------------===//
 // ASTExporter Tool
@@ -33,7 +53,49 @@ static llvm::cl::opt<Mode> astExporterMode(
 
 static llvm::cl::opt<std::string> astExporterOutput(
     "ast-exporter-output",
-    llvm::cl::desc("output file"),
+    llvm::cl::desc("output file, or output directory when -j is greater "
+                   "than 1"),
+    llvm::cl::cat(astExporterCategory));
+
+static llvm::cl::opt<unsigned> astExporterJobs(
+    "j",
+    llvm::cl::desc("Number of source files to export in parallel. Each file "
+                   "is written in the output directory under its absolute "
+                   "path, followed by the extension of the mode. With "
+                   "-ast-exporter-server, number of requests served in "
+                   "parallel."),
+    llvm::cl::init(1),
+    llvm::cl::cat(astExporterCategory));
+
+static llvm::cl::opt<std::string> astExporterHistory(
+    "ast-exporter-history",
+    llvm::cl::desc("With -j, file recording the export time and output size "
+                   "of each source file. The files that took the longest on "
+                   "the previous run are exported first."),
+    llvm::cl::cat(astExporterCategory));
+
+static llvm::cl::opt<std::string> astExporterPrelude(
+    "ast-exporter-prelude",
+    llvm::cl::desc("Header included by most source files (e.g. system and "
+                   "framework headers). It is precompiled once, with the "
+                   "compilation flags of the first source file, and the PCH "
+                   "is used by every source file of the run."),
+    llvm::cl::cat(astExporterCategory));
+
+static llvm::cl::opt<std::string> astExporterServer(
+    "ast-exporter-server",
+    llvm::cl::desc("Stay resident and export the compile commands received on "
+                   "this Unix domain socket, see runServer. Source files "
+                   "given on the command line are only used by "
+                   "-ast-exporter-prelude."),
+    llvm::cl::cat(astExporterCategory));
+
+static llvm::cl::opt<bool> astExporterServerStatCache(
+    "ast-exporter-server-stat-cache",
+    llvm::cl::desc("With -ast-exporter-server, keep the file system cache of "
+                   "each worker between the requests from the same "
+                   "directory. Only valid if the files read by the exports do "
+                   "not change while the server runs."),
     llvm::cl::cat(astExporterCategory));
 
 // TODO: Unpack the other ASTExporterOptions into native command line options.
@@ -48,31 +110,609 @@ static llvm::cl::list<std::string> astExporterOptions(
 static llvm::cl::extrahelp commonHelp(
     clang::tooling::CommonOptionsParser::HelpMessage);
 
-int main(int argc, const char **argv) {
-  clang::tooling::CommonOptionsParser optionsParser(
-      argc, argv, astExporterCategory);
-  clang::tooling::ClangTool tool(optionsParser.getCompilations(),
-                                 optionsParser.getSourcePathList());
-
-  if (!astExporterOutput.empty()) {
-    astExporterOptions.push_back("OUTPUT_FILE=" + astExporterOutput);
-  }
-
+static std::unique_ptr<clang::tooling::ToolAction> makeFactory(
+    const std::vector<std::string> &options) {
   std::unique_ptr<clang::tooling::ToolAction> factory = nullptr;
   switch (astExporterMode) {
   case json:
     factory.reset(new ASTPluginLib::SimpleFrontendActionFactory<
-                  ASTLib::JsonExporterASTAction>(astExporterOptions));
+                  ASTLib::JsonExporterASTAction>(options));
     break;
   case yojson:
     factory.reset(new ASTPluginLib::SimpleFrontendActionFactory<
-                  ASTLib::YojsonExporterASTAction>(astExporterOptions));
+                  ASTLib::YojsonExporterASTAction>(options));
     break;
   case biniou:
     factory.reset(new ASTPluginLib::SimpleFrontendActionFactory<
-                  ASTLib::BiniouExporterASTAction>(astExporterOptions));
+                  ASTLib::BiniouExporterASTAction>(options));
     break;
   }
+  return factory;
+}
+
+static const char *modeExtension() {
+  switch (astExporterMode) {
+  case json:
+    return ".json";
+  case yojson:
+    return ".yjson";
+  case biniou:
+    return ".biniou";
+  }
+  return "";
+}
+
+// Path of the precompiled prelude, or empty
+static std::string preludePCH;
+
+static const char *headerLanguage(llvm::StringRef source) {
+  llvm::StringRef ext = llvm::sys::path::extension(source);
+  if (ext == ".c") {
+    return "c-header";
+  } else if (ext == ".m") {
+    return "objective-c-header";
+  } else if (ext == ".mm") {
+    return "objective-c++-header";
+  }
+  return "c++-header";
+}
+
+// Absolute path without . and .. components, relative paths being resolved
+// from the current directory
+static std::string normalizedAbsolutePath(llvm::StringRef path) {
+  llvm::SmallString<1024> absPath(path);
+  llvm::sys::fs::make_absolute(absPath);
+  llvm::sys::path::remove_dots(absPath, /*remove_dot_dot=*/true);
+  return absPath.str();
+}
+
+// Precompiles astExporterPrelude into a temporary file, by running the
+// compilation command of the first source file on the prelude instead.
+static bool buildPrelude(
+    const clang::tooling::CompilationDatabase &compilations,
+    const std::vector<std::string> &sources) {
+  llvm::SmallString<1024> header(astExporterPrelude);
+  llvm::SmallString<1024> pch;
+  if (sources.empty() || llvm::sys::fs::make_absolute(header) ||
+      llvm::sys::fs::createTemporaryFile("ast_exporter_prelude", "pch", pch)) {
+    return false;
+  }
+  clang::tooling::ClangTool tool(compilations, sources[0]);
+  tool.clearArgumentsAdjusters();
+  tool.appendArgumentsAdjuster(clang::tooling::getClangStripOutputAdjuster());
+  tool.appendArgumentsAdjuster(
+      clang::tooling::getClangStripDependencyFileAdjuster());
+  std::string headerPath = header.str();
+  std::string pchPath = pch.str();
+  const char *language = headerLanguage(sources[0]);
+  bool missedSource = false;
+  tool.appendArgumentsAdjuster(
+      [&](const clang::tooling::CommandLineArguments &args,
+          llvm::StringRef filename) {
+        // the tool runs the adjusters from the directory of the command, so
+        // that both paths are resolved from there, however they are spelled
+        std::string source = normalizedAbsolutePath(filename);
+        clang::tooling::CommandLineArguments adjusted;
+        bool replaced = false;
+        for (const auto &arg : args) {
+          if (!replaced && !llvm::StringRef(arg).startswith("-") &&
+              normalizedAbsolutePath(arg) == source) {
+            replaced = true;
+            adjusted.push_back("-x");
+            adjusted.push_back(language);
+            adjusted.push_back(headerPath);
+          } else if (arg != "-c") {
+            adjusted.push_back(arg);
+          }
+        }
+        adjusted.push_back("-o");
+        adjusted.push_back(pchPath);
+        missedSource = missedSource || !replaced;
+        return adjusted;
+      });
+  if (tool.run(clang::tooling::newFrontendActionFactory<
+                   clang::GeneratePCHAction>()
+                   .get()) != 0 ||
+      missedSource) {
+    if (missedSource) {
+      llvm::errs() << "Cannot find " << sources[0]
+                   << " in its compilation command\n";
+    }
+    llvm::sys::fs::remove(pchPath);
+    return false;
+  }
+  preludePCH = pchPath;
+  return true;
+}
+
+static void addPreludeAdjuster(clang::tooling::ClangTool &tool) {
+  if (!preludePCH.empty()) {
+    tool.appendArgumentsAdjuster(clang::tooling::getInsertArgumentAdjuster(
+        {"-include-pch", preludePCH},
+        clang::tooling::ArgumentInsertPosition::BEGIN));
+  }
+}
+
+// Output file of a source file in the output directory, e.g.
+// /src/dir/file.c -> OUTPUT_DIR/src/dir/file.c.json
+// Missing directories are created.
+static bool makeOutputPath(const std::string &source, std::string &output) {
+  llvm::SmallString<1024> absSource(source);
+  if (llvm::sys::fs::make_absolute(absSource)) {
+    return false;
+  }
+  llvm::SmallString<1024> path(astExporterOutput);
+  llvm::sys::path::append(path, llvm::sys::path::relative_path(absSource));
+  if (llvm::sys::fs::create_directories(llvm::sys::path::parent_path(path))) {
+    return false;
+  }
+  output = (path + modeExtension()).str();
+  return true;
+}
+
+// Export cost of a source file, as measured on a previous run.
+struct ExportCost {
+  double seconds;
+  uint64_t outputSize;
+};
+
+typedef std::map<std::string, ExportCost> history_t;
+
+// The history file has one line per source file:
+// <seconds> <output size> <source path>
+static history_t loadHistory(const std::string &path) {
+  history_t history;
+  std::ifstream in(path);
+  ExportCost cost;
+  std::string source;
+  while (in >> cost.seconds >> cost.outputSize && std::getline(in, source)) {
+    if (source.size() > 1) {
+      history[source.substr(1)] = cost;
+    }
+  }
+  return history;
+}
+
+static void saveHistory(const std::string &path, const history_t &history) {
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath);
+    for (const auto &entry : history) {
+      out << entry.second.seconds << " " << entry.second.outputSize << " "
+          << entry.first << "\n";
+    }
+    if (!out) {
+      llvm::errs() << "Failed to write the history file " << tmpPath << "\n";
+      return;
+    }
+  }
+  if (llvm::sys::fs::rename(tmpPath, path)) {
+    llvm::errs() << "Failed to write the history file " << path << "\n";
+  }
+}
+
+// Source files to export, split between one queue per worker. A worker
+// takes the front of its own queue and, once it is empty, steals from the
+// back of the longest queue of the others.
+class ExportQueue {
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<const std::string *> sources;
+  };
+  std::vector<WorkerQueue> queues;
+
+ public:
+  // sources are expected to be sorted by decreasing cost, and are dealt
+  // round-robin so that every worker starts with the largest files it has
+  ExportQueue(const std::vector<const std::string *> &sources,
+              unsigned workers)
+      : queues(workers) {
+    for (size_t i = 0; i < sources.size(); ++i) {
+      queues[i % workers].sources.push_back(sources[i]);
+    }
+  }
+
+  const std::string *pop(unsigned worker) {
+    {
+      WorkerQueue &own = queues[worker];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.sources.empty()) {
+        const std::string *source = own.sources.front();
+        own.sources.pop_front();
+        return source;
+      }
+    }
+    while (true) {
+      WorkerQueue *victim = nullptr;
+      size_t victimSize = 0;
+      for (auto &queue : queues) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.sources.size() > victimSize) {
+          victim = &queue;
+          victimSize = queue.sources.size();
+        }
+      }
+      if (!victim) {
+        return nullptr;
+      }
+      std::lock_guard<std::mutex> lock(victim->mutex);
+      // the queue may have been emptied in the meantime
+      if (!victim->sources.empty()) {
+        const std::string *source = victim->sources.back();
+        victim->sources.pop_back();
+        return source;
+      }
+    }
+  }
+};
+
+struct ExportResults {
+  std::mutex mutex;
+  std::vector<std::string> failures;
+  history_t history;
+};
 
+// Exports the source files from the queue until it is empty.
+// Each file gets its own ClangTool, with a file system that does not share
+// the working directory of the process with the other workers.
+static void runWorker(const clang::tooling::CompilationDatabase &compilations,
+                      ExportQueue &queue,
+                      unsigned worker,
+                      ExportResults &results) {
+  while (const std::string *source = queue.pop(worker)) {
+    std::string output;
+    int result = 1;
+    auto start = std::chrono::steady_clock::now();
+    if (makeOutputPath(*source, output)) {
+      std::vector<std::string> options = astExporterOptions;
+      options.push_back("OUTPUT_FILE=" + output);
+      std::unique_ptr<clang::tooling::ToolAction> factory =
+          makeFactory(options);
+      clang::tooling::ClangTool tool(
+          compilations,
+          *source,
+          std::make_shared<clang::PCHContainerOperations>(),
+          llvm::vfs::createPhysicalFileSystem().release());
+      addPreludeAdjuster(tool);
+      result = tool.run(factory.get());
+    } else {
+      llvm::errs() << "Cannot create the output directory for " << *source
+                   << "\n";
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    uint64_t outputSize = 0;
+    if (result == 0) {
+      llvm::sys::fs::file_size(output, outputSize);
+    }
+
+    std::lock_guard<std::mutex> lock(results.mutex);
+    if (result != 0) {
+      // failures say nothing of the cost of the next export: the previous
+      // entry of the file, if any, is kept
+      results.failures.push_back(*source);
+    } else {
+      results.history[*source] = {elapsed.count(), outputSize};
+    }
+  }
+}
+
+// Largest predicted costs first. Files missing from the history are
+// predicted to cost as much as the average known file.
+static std::vector<const std::string *> sortByCost(
+    const std::vector<std::string> &sources, const history_t &history) {
+  double totalSeconds = 0;
+  size_t known = 0;
+  std::vector<std::pair<double, const std::string *>> costs;
+  for (const auto &source : sources) {
+    auto I = history.find(source);
+    double seconds = -1;
+    if (I != history.end()) {
+      seconds = I->second.seconds;
+      totalSeconds += seconds;
+      known++;
+    }
+    costs.emplace_back(seconds, &source);
+  }
+  double defaultSeconds = known ? totalSeconds / known : 0;
+  for (auto &cost : costs) {
+    if (cost.first < 0) {
+      cost.first = defaultSeconds;
+    }
+  }
+  std::stable_sort(costs.begin(),
+                   costs.end(),
+                   [](const std::pair<double, const std::string *> &a,
+                      const std::pair<double, const std::string *> &b) {
+                     return a.first > b.first;
+                   });
+  std::vector<const std::string *> sorted;
+  for (const auto &cost : costs) {
+    sorted.push_back(cost.second);
+  }
+  return sorted;
+}
+
+static int runParallel(const clang::tooling::CompilationDatabase &compilations,
+                       const std::vector<std::string> &sources) {
+  ExportResults results;
+  if (!astExporterHistory.empty()) {
+    results.history = loadHistory(astExporterHistory);
+  }
+  ExportQueue queue(sortByCost(sources, results.history), astExporterJobs);
+  std::vector<std::thread> workers;
+  for (unsigned worker = 0; worker < astExporterJobs; ++worker) {
+    workers.emplace_back(runWorker,
+                         std::cref(compilations),
+                         std::ref(queue),
+                         worker,
+                         std::ref(results));
+  }
+  for (auto &thread : workers) {
+    thread.join();
+  }
+  if (!astExporterHistory.empty()) {
+    saveHistory(astExporterHistory, results.history);
+  }
+
+  std::vector<std::string> &failures = results.failures;
+  if (failures.empty()) {
+    return 0;
+  }
+  std::sort(failures.begin(), failures.end());
+  llvm::errs() << failures.size() << " of " << sources.size()
+               << " files failed:\n";
+  for (const auto &source : failures) {
+    llvm::errs() << "  " << source << "\n";
+  }
+  return 1;
+}
+
+// Requests larger than this are rejected, rather than buffered for ever
+static const size_t maxRequestSize = 1 << 22;
+
+// A request is the working directory of a compile command followed by its
+// arguments, the compiler included, one per line, and an empty line.
+static bool readRequest(int fd,
+                        std::string &directory,
+                        std::vector<std::string> &args) {
+  std::string data;
+  char buf[4096];
+  while (data.find("\n\n") == std::string::npos) {
+    if (data.size() > maxRequestSize) {
+      return false;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data.append(buf, n);
+  }
+  llvm::SmallVector<llvm::StringRef, 64> lines;
+  llvm::StringRef(data).split(lines, '\n');
+  if (lines.size() < 2 || lines[0].empty() || lines[1].empty()) {
+    return false;
+  }
+  directory = lines[0];
+  args.clear();
+  for (size_t i = 1; i < lines.size() && !lines[i].empty(); ++i) {
+    args.push_back(lines[i]);
+  }
+  return true;
+}
+
+enum ReplyStatus {
+  replyExported = 0,
+  replyInvalidRequest = 1,
+  replyInvalidDirectory = 2,
+  replyExportFailed = 3,
+};
+
+// The export is followed by a trailer, big-endian:
+//   size of the export (64 bits), status (32 bits), "ASTREPLY"
+// A reply without trailer, or whose size does not match, is truncated.
+static void writeReplyTrailer(int fd, uint64_t size, ReplyStatus status) {
+  char trailer[20];
+  for (int i = 0; i < 8; ++i) {
+    trailer[i] = (char)(size >> (56 - 8 * i));
+  }
+  for (int i = 0; i < 4; ++i) {
+    trailer[8 + i] = (char)((uint32_t)status >> (24 - 8 * i));
+  }
+  memcpy(trailer + 12, "ASTREPLY", 8);
+  const char *ptr = trailer;
+  size_t left = sizeof(trailer);
+  while (left > 0) {
+    ssize_t n = write(fd, ptr, left);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      // the client went away
+      return;
+    }
+    ptr += n;
+    left -= n;
+  }
+}
+
+// Serves requests until accept fails. Each export gets its own compiler
+// instance, like with ClangTool, but the process, the precompiled prelude and
+// with -ast-exporter-server-stat-cache the FileManager are kept warm.
+static void runServerWorker(int listenFd) {
+  // see the resource dir in ClangTool::run
+  static int staticSymbol;
+  auto pchContainerOps = std::make_shared<clang::PCHContainerOperations>();
+  clang::tooling::ArgumentsAdjuster adjuster =
+      clang::tooling::combineAdjusters(
+          clang::tooling::getClangStripOutputAdjuster(),
+          clang::tooling::combineAdjusters(
+              clang::tooling::getClangSyntaxOnlyAdjuster(),
+              clang::tooling::getClangStripDependencyFileAdjuster()));
+  if (!preludePCH.empty()) {
+    adjuster = clang::tooling::combineAdjusters(
+        adjuster,
+        clang::tooling::getInsertArgumentAdjuster(
+            {"-include-pch", preludePCH},
+            clang::tooling::ArgumentInsertPosition::BEGIN));
+  }
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs;
+  // reference counted, the compiler instance of each export holds it too
+  llvm::IntrusiveRefCntPtr<clang::FileManager> files;
+  std::string filesDirectory;
+  while (true) {
+    int conn = accept(listenFd, nullptr, nullptr);
+    if (conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      // read before errs() may change it
+      int error = errno;
+      llvm::errs() << "Failed to accept a request: " << strerror(error)
+                   << "\n";
+      return;
+    }
+    std::string directory;
+    std::vector<std::string> args;
+    ReplyStatus status = replyExported;
+    uint64_t size = 0;
+    if (!readRequest(conn, directory, args)) {
+      llvm::errs() << "Invalid request\n";
+      status = replyInvalidRequest;
+    } else {
+      if (!files || !astExporterServerStatCache ||
+          directory != filesDirectory) {
+        // the working directory of the physical file system is its own
+        fs = llvm::vfs::createPhysicalFileSystem().release();
+        files = new clang::FileManager(clang::FileSystemOptions(), fs);
+        filesDirectory = directory;
+      }
+      if (fs->setCurrentWorkingDirectory(directory)) {
+        llvm::errs() << "Cannot chdir into " << directory << "\n";
+        status = replyInvalidDirectory;
+      } else {
+        args = adjuster(args, "");
+        if (std::none_of(args.begin(), args.end(), [](llvm::StringRef arg) {
+              return arg.startswith("-resource-dir");
+            })) {
+          args.push_back("-resource-dir=" +
+                         clang::CompilerInvocation::GetResourcesPath(
+                             "clang_tool", &staticSymbol));
+        }
+        // the export is written straight to the connection
+        std::string output = "fd:" + std::to_string(conn);
+        std::vector<std::string> options = astExporterOptions;
+        options.push_back("OUTPUT_FILE=" + output);
+        std::unique_ptr<clang::tooling::ToolAction> factory =
+            makeFactory(options);
+        clang::tooling::ToolInvocation invocation(
+            std::move(args), factory.get(), files.get(), pchContainerOps);
+        bool exported = invocation.run();
+        // also forgets the size of the output, the descriptor being reused
+        bool written = ASTPluginLib::closedStreamOutputSize(output, size);
+        if (!exported || !written) {
+          llvm::errs() << "Error while processing a request from "
+                       << directory << "\n";
+          status = replyExportFailed;
+        }
+      }
+    }
+    // the client reads the reply until the end of the connection
+    writeReplyTrailer(conn, size, status);
+    close(conn);
+  }
+}
+
+static int runServer() {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (astExporterServer.size() >= sizeof(addr.sun_path)) {
+    llvm::errs() << "Socket path too long: " << astExporterServer << "\n";
+    return 1;
+  }
+  memcpy(addr.sun_path, astExporterServer.data(), astExporterServer.size());
+  // clients may go away before the end of their export
+  signal(SIGPIPE, SIG_IGN);
+  // a socket left behind by a previous server
+  llvm::sys::fs::remove(astExporterServer);
+  int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  // only the user may connect, to export files readable by the server: the
+  // socket is created without permissions for the others, which the chmod
+  // makes explicit
+  mode_t mask = umask(0077);
+  bool bound = listenFd >= 0 &&
+               bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+  umask(mask);
+  if (!bound || chmod(astExporterServer.c_str(), 0600) != 0 ||
+      listen(listenFd, SOMAXCONN) != 0) {
+    int error = errno;
+    llvm::errs() << "Cannot listen on " << astExporterServer << ": "
+                 << strerror(error) << "\n";
+    return 1;
+  }
+  std::vector<std::thread> workers;
+  for (unsigned worker = 0; worker < std::max(1u, (unsigned)astExporterJobs);
+       ++worker) {
+    workers.emplace_back(runServerWorker, listenFd);
+  }
+  for (auto &thread : workers) {
+    thread.join();
+  }
+  close(listenFd);
+  return 1;
+}
+
+static int run(clang::tooling::CommonOptionsParser &optionsParser) {
+  if (!astExporterServer.empty()) {
+    return runServer();
+  }
+  if (astExporterJobs > 1) {
+    if (astExporterOutput.empty()) {
+      llvm::errs() << "-j requires an output directory "
+                      "(-ast-exporter-output)\n";
+      return 1;
+    }
+    return runParallel(optionsParser.getCompilations(),
+                       optionsParser.getSourcePathList());
+  }
+
+  clang::tooling::ClangTool tool(optionsParser.getCompilations(),
+                                 optionsParser.getSourcePathList());
+
+  if (!astExporterOutput.empty()) {
+    astExporterOptions.push_back("OUTPUT_FILE=" + astExporterOutput);
+  }
+
+  std::unique_ptr<clang::tooling::ToolAction> factory =
+      makeFactory(astExporterOptions);
+
+  addPreludeAdjuster(tool);
   return tool.run(factory.get());
 }
+
+int main(int argc, const char **argv) {
+  // source files are optional with -ast-exporter-server
+  clang::tooling::CommonOptionsParser optionsParser(
+      argc, argv, astExporterCategory, llvm::cl::ZeroOrMore);
+  if (optionsParser.getSourcePathList().empty() &&
+      (astExporterServer.empty() || !astExporterPrelude.empty())) {
+    llvm::errs() << "No source file given\n";
+    return 1;
+  }
+
+  if (!astExporterPrelude.empty() &&
+      !buildPrelude(optionsParser.getCompilations(),
+                    optionsParser.getSourcePathList())) {
+    llvm::errs() << "Failed to precompile " << astExporterPrelude << "\n";
+    return 1;
+  }
+  int result = run(optionsParser);
+  if (!preludePCH.empty()) {
+    llvm::sys::fs::remove(preludePCH);
+  }
+  return result;
+}
@@ -7,10 +7,16 @@
 
 #pragma once
 
+#include <algorithm>
 #include <assert.h>
+#include <cstring>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace ATDWriter {
@@ -18,6 +24,11 @@ namespace ATDWriter {
 struct ATDWriterOptions {
   bool useYojson;
   bool prettifyJson;
+  // write record sizes once their fields are known (binary formats only)
+  bool streamContainers;
+  // replace the repeated strings of each top-level value by references to
+  // their first occurrence, see GenWriter::emitInternedString
+  bool internStrings;
 };
 
 // Symbols to be stacked
@@ -30,17 +41,230 @@ enum ContainerSizeKind {
   CSKMAX // the container expects at most this number of items
 };
 
+// Name of a record field or of a variant constructor, together with its
+// biniou hash
+// - when built from a string literal in a constant expression, the hash is
+// computed at compile time
+// - the tag does not own the characters: they must outlive the tag
+class Tag {
+  const char *data_;
+  size_t size_;
+  uint32_t hash_;
+
+  static constexpr size_t length(const char *str) {
+    size_t size = 0;
+    while (str[size]) {
+      size++;
+    }
+    return size;
+  }
+
+  // string hash algorithm from the biniou spec
+  static constexpr uint32_t biniou_hash(const char *str, size_t size) {
+    uint32_t hash = 0;
+    for (size_t i = 0; i < size; i++) {
+      hash = 223 * hash + str[i];
+    }
+    hash %= 1u << 31;
+    return hash;
+  }
+
+ public:
+  constexpr Tag(const char *str)
+      : data_(str), size_(length(str)), hash_(biniou_hash(str, size_)) {}
+  Tag(const char *str, size_t size)
+      : data_(str), size_(size), hash_(biniou_hash(str, size)) {}
+  Tag(const std::string &str) : Tag(str.data(), str.size()) {}
+
+  constexpr const char *data() const { return data_; }
+  constexpr size_t size() const { return size_; }
+  constexpr uint32_t hash() const { return hash_; }
+  std::string str() const { return std::string(data_, size_); }
+};
+
+// First container found with an unexpected number of elements by the size
+// checks of GenWriter
+struct SizeError {
+  // innermost variant enclosing the container, e.g. the kind of an AST node,
+  // or empty
+  std::string variant;
+  enum Symbol container;
+  int expected;
+  int actual;
+  // whether the container expected at most this number of elements
+  bool atMost;
+};
+
 // Main class for writing ATD-like data
 // - In NDEBUG mode this class is only a wrapper around an ATDEmitter
 // - In DEBUG mode it acts as a validator: asserts will fire if the events do
 // not correspond to a well-formed ATD/JSON value
+// - Once enableSizeChecks() is called, the number of elements of containers
+// of known size is checked in any mode, with a fixed cost per event, and the
+// first mismatch is kept in sizeError()
 template <class ATDEmitter>
 class GenWriter {
 
+ public:
+  typedef ATDWriter::Tag Tag;
+
  protected:
   ATDEmitter emitter_;
 
  private:
+  // Containers deeper than this are not checked
+  static const int MAX_CHECKED_DEPTH = 256;
+
+  struct CheckedContainer {
+    enum Symbol symbol;
+    enum ContainerSizeKind sizeKind;
+    int expected;
+    int count;
+    // innermost enclosing variant tag, whose characters are still alive
+    const char *variant;
+    size_t variantSize;
+  };
+
+  bool checkSizes_;
+  // number of opened containers
+  int checkedDepth_;
+  CheckedContainer checked_[MAX_CHECKED_DEPTH];
+  bool hasSizeError_;
+  SizeError sizeError_;
+
+  // Shorter strings are not worth a reference
+  static const size_t MIN_INTERNED_STRING_SIZE = 8;
+  static const char INTERNED_STRING_MARKER = '\x01';
+
+  struct StringView {
+    const char *data;
+    size_t size;
+    bool operator==(const StringView &other) const {
+      return size == other.size && memcmp(data, other.data, size) == 0;
+    }
+  };
+  struct StringViewHash {
+    // 64 bits fnv-1a
+    size_t operator()(const StringView &s) const {
+      uint64_t hash = 14695981039346656037ULL;
+      for (size_t i = 0; i < s.size; i++) {
+        hash = (hash ^ (unsigned char)s.data[i]) * 1099511628211ULL;
+      }
+      return hash;
+    }
+  };
+
+  bool internStrings_;
+  // strings of the current top-level value, numbered by first occurrence
+  std::deque<std::string> internedStrings_;
+  std::unordered_map<StringView, uint64_t, StringViewHash> internedIndices_;
+  // number of the strings of the current top-level value written in full
+  uint64_t internedCount_;
+
+  // With internStrings, a string of MIN_INTERNED_STRING_SIZE bytes or more
+  // which was already written in the current top-level value is replaced by
+  // the marker followed by the decimal number of its first occurrence, where
+  // the strings of that size written in full are numbered from 0. Strings
+  // starting with the marker are written with the marker doubled. Readers
+  // rebuild the numbering as they go, so values must be decoded in order,
+  // and each top-level value (i.e. each frame) can be decoded on its own.
+  // Readers number every string of the output, which in standard JSON
+  // includes the constructors of variants, see countInternedString.
+  void emitInternedString(const char *val, size_t size) {
+    if (size >= MIN_INTERNED_STRING_SIZE) {
+      auto it = internedIndices_.find(StringView{val, size});
+      if (it != internedIndices_.end()) {
+        char buffer[24];
+        char *end = buffer + sizeof(buffer);
+        char *pos = end;
+        uint64_t index = it->second;
+        do {
+          *--pos = '0' + index % 10;
+          index /= 10;
+        } while (index > 0);
+        *--pos = INTERNED_STRING_MARKER;
+        emitter_.emitString(pos, end - pos);
+        return;
+      }
+      internedStrings_.emplace_back(val, size);
+      const std::string &interned = internedStrings_.back();
+      internedIndices_.emplace(StringView{interned.data(), interned.size()},
+                               internedCount_++);
+    }
+    if (size > 0 && val[0] == INTERNED_STRING_MARKER) {
+      std::string escaped(1, INTERNED_STRING_MARKER);
+      escaped.append(val, size);
+      emitter_.emitString(escaped.data(), escaped.size());
+    } else {
+      emitter_.emitString(val, size);
+    }
+  }
+
+  // Constructors of variants are written in full, but they are strings of the
+  // output in standard JSON, where they take a number all the same.
+  void countInternedString(const Tag &tag) {
+    if (internStrings_ && emitter_.shouldSimpleVariantsBeEmittedAsStrings &&
+        tag.size() >= MIN_INTERNED_STRING_SIZE) {
+      internedCount_++;
+    }
+  }
+
+  void checkValue() {
+    if (checkSizes_ && checkedDepth_ > 0 &&
+        checkedDepth_ <= MAX_CHECKED_DEPTH) {
+      checked_[checkedDepth_ - 1].count++;
+    }
+  }
+
+  void checkEnterContainer(enum Symbol s,
+                           enum ContainerSizeKind csk,
+                           int numElems,
+                           const Tag *tag) {
+    if (!checkSizes_) {
+      return;
+    }
+    if (checkedDepth_ < MAX_CHECKED_DEPTH) {
+      CheckedContainer &c = checked_[checkedDepth_];
+      c.symbol = s;
+      c.sizeKind = csk;
+      c.expected = numElems;
+      c.count = 0;
+      if (tag) {
+        c.variant = tag->data();
+        c.variantSize = tag->size();
+      } else if (checkedDepth_ > 0) {
+        c.variant = checked_[checkedDepth_ - 1].variant;
+        c.variantSize = checked_[checkedDepth_ - 1].variantSize;
+      } else {
+        c.variant = "";
+        c.variantSize = 0;
+      }
+    }
+    checkedDepth_++;
+  }
+
+  void checkLeaveContainer() {
+    if (!checkSizes_) {
+      return;
+    }
+    checkedDepth_--;
+    if (checkedDepth_ < MAX_CHECKED_DEPTH && !hasSizeError_) {
+      const CheckedContainer &c = checked_[checkedDepth_];
+      bool ok = c.sizeKind == CSKNONE ||
+                (c.sizeKind == CSKEXACT ? c.count == c.expected
+                                        : c.count <= c.expected);
+      if (!ok) {
+        hasSizeError_ = true;
+        sizeError_ = {std::string(c.variant, c.variantSize),
+                      c.symbol,
+                      c.expected,
+                      c.count,
+                      c.sizeKind == CSKMAX};
+      }
+    }
+    checkValue();
+  }
+
 #ifdef DEBUG
   // State of the automaton
   std::vector<enum Symbol> stack_;
@@ -85,11 +309,14 @@ class GenWriter {
   void emitValue() {
     enterValue();
     leaveValue();
+    checkValue();
   }
 
   void enterContainer(enum Symbol s,
                       enum ContainerSizeKind csk = CSKNONE,
-                      int numElems = 0) {
+                      int numElems = 0,
+                      const Tag *tag = nullptr) {
+    checkEnterContainer(s, csk, numElems, tag);
 #ifdef DEBUG
     enterValue();
     stack_.push_back(s);
@@ -123,10 +350,17 @@ class GenWriter {
     containerSizeKind_.pop_back();
     leaveValue();
 #endif
+    checkLeaveContainer();
   }
 
  public:
-  GenWriter(ATDEmitter emitter) : emitter_(emitter) {
+  GenWriter(ATDEmitter emitter, bool internStrings = false)
+      : emitter_(std::move(emitter)),
+        checkSizes_(false),
+        checkedDepth_(0),
+        hasSizeError_(false),
+        internStrings_(internStrings),
+        internedCount_(0) {
 #ifdef DEBUG
     containerSizeKind_.push_back(CSKNONE);
 #endif
@@ -141,6 +375,29 @@ class GenWriter {
     emitter_.emitEOF();
   }
 
+  // Start checking the sizes of containers, before the first event
+  void enableSizeChecks() { checkSizes_ = true; }
+
+  // The first size mismatch found, or null
+  const SizeError *sizeError() const {
+    return hasSizeError_ ? &sizeError_ : nullptr;
+  }
+
+  // Number of bytes written so far, buffered ones included
+  uint64_t bytesWritten() const { return emitter_.bytesWritten(); }
+
+  // Terminate the current top-level value, so that the output so far can be
+  // used on its own and another value can follow
+  void emitEndOfValue() {
+#ifdef DEBUG
+    assert(stack_.empty());
+#endif
+    emitter_.emitEndOfValue();
+    internedIndices_.clear();
+    internedStrings_.clear();
+    internedCount_ = 0;
+  }
+
   void emitNull() {
     emitValue();
     emitter_.emitNull();
@@ -157,11 +414,24 @@ class GenWriter {
     emitValue();
     emitter_.emitFloat(val);
   }
-  void emitString(const std::string &val) {
+  // Strings are written from a view of their characters, without copies:
+  // std::string, string literals, and any string-like value exposing data()
+  // and size() such as llvm::StringRef
+  void emitString(const char *val, size_t size) {
     emitValue();
-    emitter_.emitString(val);
+    if (internStrings_) {
+      emitInternedString(val, size);
+    } else {
+      emitter_.emitString(val, size);
+    }
+  }
+  void emitString(const char *val) { emitString(val, strlen(val)); }
+  template <class String>
+  auto emitString(const String &val)
+      -> decltype(val.data(), val.size(), void()) {
+    emitString(val.data(), val.size());
   }
-  void emitTag(const std::string &val) {
+  void emitTag(const Tag &val) {
 #ifdef DEBUG
     assert(needsTag(stack_.back()));
     stack_.push_back(STAG);
@@ -206,20 +476,24 @@ class GenWriter {
     emitter_.leaveTuple();
   }
 
-  void enterVariant(const std::string &tag, bool hasArg = true) {
+  void enterVariant(const Tag &tag, bool hasArg = true) {
     // variants have at most one value, so we can safely use hasArg
     // as the number of arguments
-    enterContainer(SVARIANT, CSKEXACT, hasArg);
+    enterContainer(SVARIANT, CSKEXACT, hasArg, &tag);
     emitter_.enterVariant();
+    countInternedString(tag);
     emitter_.emitVariantTag(tag, hasArg);
   }
   void leaveVariant() {
     leaveContainer(SVARIANT);
     emitter_.leaveVariant();
   }
-  void emitSimpleVariant(const std::string &tag) {
+  void emitSimpleVariant(const Tag &tag) {
     if (emitter_.shouldSimpleVariantsBeEmittedAsStrings) {
-      emitString(tag);
+      // constructors are never replaced
+      emitValue();
+      countInternedString(tag);
+      emitter_.emitString(tag.data(), tag.size());
     } else {
       enterVariant(tag, false);
       leaveVariant();
@@ -228,7 +502,7 @@ class GenWriter {
 
   // convenient methods
 
-  void emitFlag(const std::string &tag, bool val) {
+  void emitFlag(const Tag &tag, bool val) {
     if (val) {
       emitTag(tag);
       emitBoolean(true);
@@ -268,7 +542,7 @@ class GenWriter {
     GenWriter &f_;
 
    public:
-    VariantScope(GenWriter &f, const std::string &tag) : f_(f) {
+    VariantScope(GenWriter &f, const Tag &tag) : f_(f) {
       f_.enterVariant(tag, true);
     }
     ~VariantScope() { f_.leaveVariant(); }
@@ -282,6 +556,8 @@ class JsonEmitter {
   const char *QUOTE = "\"";
   const char *COMMA = ",";
   const char *TAB = "  ";
+  static const unsigned TAB_SIZE = 2;
+  static const char NEWLINE_CHAR = '\n';
   const char *NEWLINE = "\n";
   const char *COLON = ":";
   const char *COLONWITHSPACES = " : ";
@@ -305,6 +581,8 @@ class JsonEmitter {
   bool nextElementNeedsNewLine_;
   bool previousElementNeedsComma_;
   bool previousElementIsVariantTag_;
+  // nothing was written since the last call to emitEndOfValue
+  bool atEndOfValue_;
 
  public:
   bool shouldSimpleVariantsBeEmittedAsStrings;
@@ -316,9 +594,11 @@ class JsonEmitter {
         nextElementNeedsNewLine_(false),
         previousElementNeedsComma_(false),
         previousElementIsVariantTag_(false),
+        atEndOfValue_(false),
         shouldSimpleVariantsBeEmittedAsStrings(!opts.useYojson) {}
 
   void tab() {
+    atEndOfValue_ = false;
     if (previousElementIsVariantTag_) {
       if (options_.prettifyJson) {
         os_ << (options_.useYojson ? COLONWITHSPACES : COMMAWITHSPACES);
@@ -329,46 +609,124 @@ class JsonEmitter {
       os_ << COMMA;
     }
     if (nextElementNeedsNewLine_ && options_.prettifyJson) {
-      os_ << NEWLINE;
-      for (size_t i = 0; i < indentLevel_; i++) {
-        os_ << TAB;
-      }
+      writeNewLine();
     }
   }
 
  private:
-  // TODO: unicode and other control chars
-  void write_escaped(const std::string &val) {
-    for (std::string::const_iterator i = val.begin(), e = val.end(); i != e;
-         i++) {
-      char x = *i;
-      switch (x) {
-      case '\\':
-        os_ << "\\\\";
-        break;
-      case '"':
-        os_ << "\\\"";
-        break;
-      case '\n':
-        os_ << "\\n";
-        break;
-      case '\t':
-        os_ << "\\t";
-        break;
-      case '\b':
-        os_ << "\\b";
-        break;
-      case '\f':
-        os_ << "\\f";
-        break;
-      case '\r':
-        os_ << "\\r";
-        break;
-      default:
-        os_ << x;
-        break;
+  // A newline followed by the indentation for MAX_INDENT_LEVEL levels, so
+  // that a newline and its indentation can be written at once.
+  static const unsigned MAX_INDENT_LEVEL = 64;
+  static const char *newLineAndIndent() {
+    static const std::string table =
+        NEWLINE_CHAR + std::string(MAX_INDENT_LEVEL * TAB_SIZE, ' ');
+    return table.data();
+  }
+
+  void writeNewLine() {
+    unsigned level =
+        indentLevel_ < MAX_INDENT_LEVEL ? indentLevel_ : MAX_INDENT_LEVEL;
+    os_.write(newLineAndIndent(), 1 + level * TAB_SIZE);
+    for (unsigned i = MAX_INDENT_LEVEL; i < indentLevel_; i++) {
+      os_ << TAB;
+    }
+  }
+
+  // Format the integer into a local buffer, from the last digit on
+  void writeInteger(int64_t val) {
+    char buf[20];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    // negate as unsigned to support the minimal value
+    uint64_t x = val < 0 ? -(uint64_t)val : val;
+    do {
+      *--p = '0' + x % 10;
+      x /= 10;
+    } while (x != 0);
+    if (val < 0) {
+      *--p = '-';
+    }
+    os_.write(p, end - p);
+  }
+
+  // Quotes, backslashes and control characters must be escaped. Non-ASCII
+  // bytes are copied as is: the input is expected to be UTF-8 already.
+  static bool needsEscape(unsigned char c) {
+    return c < 0x20 || c == '"' || c == '\\';
+  }
+
+  // Whether any of the 8 bytes of w needs to be escaped
+  static bool wordNeedsEscape(uint64_t w) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    uint64_t control = (w - ones * 0x20) & ~w;
+    uint64_t quote = w ^ (ones * '"');
+    quote = (quote - ones) & ~quote;
+    uint64_t backslash = w ^ (ones * '\\');
+    backslash = (backslash - ones) & ~backslash;
+    return ((control | quote | backslash) & highs) != 0;
+  }
+
+  void write_escaped_char(unsigned char x) {
+    switch (x) {
+    case '\\':
+      os_ << "\\\\";
+      break;
+    case '"':
+      os_ << "\\\"";
+      break;
+    case '\n':
+      os_ << "\\n";
+      break;
+    case '\t':
+      os_ << "\\t";
+      break;
+    case '\b':
+      os_ << "\\b";
+      break;
+    case '\f':
+      os_ << "\\f";
+      break;
+    case '\r':
+      os_ << "\\r";
+      break;
+    default: {
+      const char *HEX = "0123456789abcdef";
+      const char buf[] = {'\\', 'u', '0', '0', HEX[x >> 4], HEX[x & 15]};
+      os_.write(buf, sizeof(buf));
+      break;
+    }
+    }
+  }
+
+  // Copy runs of characters that need no escaping with a single write,
+  // looking for special characters 8 bytes at a time
+  void write_escaped(const char *val, size_t size) {
+    const char *run = val;
+    const char *i = val, *e = val + size;
+    while (i != e) {
+      if (e - i >= 8) {
+        uint64_t w;
+        memcpy(&w, i, sizeof(w));
+        if (!wordNeedsEscape(w)) {
+          i += 8;
+          continue;
+        }
+      }
+      const char *end = std::min(i + 8, e);
+      for (; i != end; i++) {
+        if (needsEscape(*i)) {
+          if (i != run) {
+            os_.write(run, i - run);
+          }
+          write_escaped_char(*i);
+          run = i + 1;
+        }
       }
     }
+    if (i != run) {
+      os_.write(run, i - run);
+    }
   }
 
   void enterContainer(char c) {
@@ -392,7 +750,20 @@ class JsonEmitter {
   }
 
  public:
-  void emitEOF() { os_ << NEWLINE; }
+  // requires an OStream with tell(), such as llvm::raw_ostream
+  uint64_t bytesWritten() const { return os_.tell(); }
+  void emitEOF() {
+    if (!atEndOfValue_) {
+      os_ << NEWLINE;
+    }
+  }
+  void emitEndOfValue() {
+    os_ << NEWLINE;
+    previousElementNeedsComma_ = false;
+    nextElementNeedsNewLine_ = false;
+    previousElementIsVariantTag_ = false;
+    atEndOfValue_ = true;
+  }
 
   void emitNull() {
     tab();
@@ -410,24 +781,24 @@ class JsonEmitter {
   }
   void emitInteger(int64_t val) {
     tab();
-    os_ << val;
+    writeInteger(val);
     previousElementNeedsComma_ = true;
     nextElementNeedsNewLine_ = true;
     previousElementIsVariantTag_ = false;
   }
-  void emitString(const std::string &val) {
+  void emitString(const char *val, size_t size) {
     tab();
     os_ << QUOTE;
-    write_escaped(val);
+    write_escaped(val, size);
     os_ << QUOTE;
     previousElementNeedsComma_ = true;
     nextElementNeedsNewLine_ = true;
     previousElementIsVariantTag_ = false;
   }
-  void emitTag(const std::string &val) {
+  void emitTag(const Tag &val) {
     tab();
     os_ << QUOTE;
-    write_escaped(val);
+    write_escaped(val.data(), val.size());
     os_ << QUOTE;
     if (options_.prettifyJson) {
       os_ << COLONWITHSPACES;
@@ -438,10 +809,10 @@ class JsonEmitter {
     nextElementNeedsNewLine_ = false;
     previousElementIsVariantTag_ = false;
   }
-  void emitVariantTag(const std::string &val, bool hasArgs) {
+  void emitVariantTag(const Tag &val, bool hasArgs) {
     tab();
     os_ << QUOTE;
-    write_escaped(val);
+    write_escaped(val.data(), val.size());
     os_ << QUOTE;
     previousElementNeedsComma_ = false;
     nextElementNeedsNewLine_ = false;
@@ -489,13 +860,171 @@ const uint8_t TABLE_tag = 25;
 const uint8_t SHARED_tag = 26;
 
 const int SIZE_NOT_NEEDED = -1;
+// the size is written when the container is closed
+const int SIZE_PATCHED = -2;
+
+// field used to pad records to their declared size
+constexpr Tag dummy_tag("!!DUMMY!!");
+
+// Contiguous output buffer for binary emitters
+// - values are encoded in place and handed over to the underlying stream in
+// large chunks, so that the cost of OStream::write is amortized
+// - the buffer is allocated once and flushed on request or on destruction
+// - size slots can be reserved and patched later on; bytes following the
+// oldest unpatched slot are kept (and the buffer grows) until it is patched
+template <class OStream = std::ostream>
+class OutputBuffer {
+
+  static const size_t BUFFER_SIZE = 64 * 1024;
+  // maximal length of an encoded uvint
+  static const size_t MAX_UVINT_SIZE = 10;
+
+ public:
+  // length of a patchable uvint: enough for any int
+  static const size_t SLOT_SIZE = 5;
+
+ private:
+  OStream &os_;
+  std::unique_ptr<char[]> buffer_;
+  size_t capacity_;
+  size_t pos_;
+  // number of bytes already handed over to os_
+  size_t flushed_;
+  // absolute offsets of the slots waiting to be patched, oldest first
+  std::vector<size_t> slots_;
+
+  // write out everything that precedes the oldest unpatched slot
+  void flushAvailable() {
+    size_t limit = slots_.empty() ? pos_ : slots_.front() - flushed_;
+    if (limit > 0) {
+      os_.write(buffer_.get(), limit);
+      memmove(buffer_.get(), buffer_.get() + limit, pos_ - limit);
+      pos_ -= limit;
+      flushed_ += limit;
+    }
+  }
+
+  void reserve(size_t n) {
+    if (pos_ + n <= capacity_) {
+      return;
+    }
+    flushAvailable();
+    if (pos_ + n > capacity_) {
+      size_t capacity = std::max(2 * capacity_, pos_ + n);
+      std::unique_ptr<char[]> buffer(new char[capacity]);
+      memcpy(buffer.get(), buffer_.get(), pos_);
+      buffer_ = std::move(buffer);
+      capacity_ = capacity;
+    }
+  }
+
+ public:
+  OutputBuffer(OStream &os)
+      : os_(os),
+        buffer_(new char[BUFFER_SIZE]),
+        capacity_(BUFFER_SIZE),
+        pos_(0),
+        flushed_(0) {}
+  OutputBuffer(OutputBuffer &&other)
+      : os_(other.os_),
+        buffer_(std::move(other.buffer_)),
+        capacity_(other.capacity_),
+        pos_(other.pos_),
+        flushed_(other.flushed_),
+        slots_(std::move(other.slots_)) {
+    other.pos_ = 0;
+  }
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+  ~OutputBuffer() { flush(); }
+
+  void flush() {
+    assert(slots_.empty());
+    flushAvailable();
+  }
+
+  uint64_t bytesWritten() const { return flushed_ + pos_; }
+
+  void write8(uint8_t c) {
+    reserve(1);
+    buffer_[pos_++] = c;
+  }
+
+  // big-endian, as required by biniou for field and variant hashes
+  void write32(uint32_t x) {
+    reserve(4);
+    char *p = buffer_.get() + pos_;
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+    pos_ += 4;
+  }
+
+  void writeUvint(uint64_t x) {
+    reserve(MAX_UVINT_SIZE);
+    char *p = buffer_.get() + pos_;
+    while (x > 127) {
+      *p++ = x | 128;
+      x >>= 7;
+    }
+    *p++ = (uint8_t)x;
+    pos_ = p - buffer_.get();
+  }
+
+  void writeSvint(int64_t x) {
+    if (x >= 0) {
+      uint64_t t = x;
+      t = t * 2;
+      writeUvint(t);
+    } else {
+      uint64_t t = -x;
+      t = t * 2 - 1;
+      writeUvint(t);
+    }
+  }
+
+  void writeBytes(const char *data, size_t size) {
+    if (size > BUFFER_SIZE && slots_.empty()) {
+      // too large to be buffered: bypass the buffer
+      flush();
+      os_.write(data, size);
+      return;
+    }
+    reserve(size);
+    memcpy(buffer_.get() + pos_, data, size);
+    pos_ += size;
+  }
+
+  // Reserve room for a uvint whose value is not known yet. Slots must be
+  // patched in the reverse order of their creation.
+  void openUvintSlot() {
+    reserve(SLOT_SIZE);
+    slots_.push_back(flushed_ + pos_);
+    pos_ += SLOT_SIZE;
+  }
+
+  // Fill in the most recently opened slot. The value is written as a
+  // non-minimal uvint of exactly SLOT_SIZE bytes, which decoders accept.
+  void patchUvintSlot(uint32_t x) {
+    assert(!slots_.empty());
+    char *p = buffer_.get() + (slots_.back() - flushed_);
+    slots_.pop_back();
+    for (size_t i = 0; i < SLOT_SIZE - 1; i++) {
+      *p++ = (x & 127) | 128;
+      x >>= 7;
+    }
+    *p = x;
+  }
+};
 
 // Configure GenWriter for Biniou binary output
 template <class OStream = std::ostream>
 class BiniouEmitter {
 
  private:
-  OStream &os_;
+  OutputBuffer<OStream> out_;
 
   // Opened container, writing in progress.
   struct ATDContainer {
@@ -509,10 +1038,15 @@ class BiniouEmitter {
   // The full stack of opened containers
   std::vector<ATDContainer> atdContainers;
 
+  // Whether records are written with their actual number of fields
+  // instead of being padded up to their declared maximal size
+  const bool streamContainers_;
+
  public:
   const bool shouldSimpleVariantsBeEmittedAsStrings = false;
 
-  BiniouEmitter(OStream &os) : os_(os) {}
+  BiniouEmitter(OStream &os, bool streamContainers = false)
+      : out_(os), streamContainers_(streamContainers) {}
 
  private:
   bool isValueTagNeeded() {
@@ -532,123 +1066,90 @@ class BiniouEmitter {
   void enterContainer(uint8_t tag, int size) {
     bool needTag = isValueTagNeeded();
     atdContainers.emplace_back(tag, size);
-    writeValueTag(os_, needTag, tag);
-    if (size != SIZE_NOT_NEEDED) {
-      writeUvint(os_, size);
+    writeValueTag(needTag, tag);
+    if (size == SIZE_PATCHED) {
+      out_.openUvintSlot();
+    } else if (size != SIZE_NOT_NEEDED) {
+      out_.writeUvint(size);
     }
   }
 
   void leaveContainer() {
+    const ATDContainer &obj = atdContainers.back();
+    if (obj.size == SIZE_PATCHED) {
+      // records count one write for the tag and one for the value
+      out_.patchUvintSlot(obj.tag == RECORD_tag ? obj.count / 2 : obj.count);
+    }
     atdContainers.pop_back();
     markWrite();
   }
 
-  // string hash algorithm from the biniou spec
-  static uint32_t biniou_hash(const std::string &str) {
-    uint32_t hash = 0;
-    for (const char &c : str) {
-      hash = 223 * hash + c;
-    }
-    hash %= 1 << 31;
-    return hash;
-  }
-
-  static void write8(OStream &os, uint8_t c) { os.write((const char *)&c, 1); }
-
-  static void write32(OStream &os, int32_t x) {
-    write8(os, x >> 24);
-    write8(os, x >> 16);
-    write8(os, x >> 8);
-    write8(os, x);
-  }
-
-  static void writeUvint(OStream &os, uint64_t x) {
-    while (x > 127) {
-      write8(os, x | 128);
-      x >>= 7;
-    }
-
-    write8(os, (uint8_t)x);
-  }
-
-  static void writeSvint(OStream &os, int64_t x) {
-    if (x >= 0) {
-      uint64_t t = x;
-      t = t * 2;
-      writeUvint(os, t);
-    } else {
-      uint64_t t = -x;
-      t = t * 2 - 1;
-      writeUvint(os, t);
-    }
-  }
-
-  static void writeValueTag(OStream &os, bool needTag, uint8_t tag) {
+  void writeValueTag(bool needTag, uint8_t tag) {
     if (needTag) {
-      write8(os, tag);
+      out_.write8(tag);
     }
   }
 
   void emitDummyRecordField() {
-    emitTag("!!DUMMY!!");
+    emitTag(dummy_tag);
     markWrite();
     // unit is the smallest value (2 bytes)
-    write8(os_, unit_tag);
-    write8(os_, 0);
+    out_.write8(unit_tag);
+    out_.write8(0);
   }
 
  public:
-  void emitEOF() {}
+  uint64_t bytesWritten() const { return out_.bytesWritten(); }
+  void emitEOF() { out_.flush(); }
+  void emitEndOfValue() { out_.flush(); }
 
   void emitBoolean(bool val) {
     bool needTag = isValueTagNeeded();
     markWrite();
-    writeValueTag(os_, needTag, bool_tag);
-    write8(os_, val);
+    writeValueTag(needTag, bool_tag);
+    out_.write8(val);
   }
 
   void emitInteger(int64_t val) {
     bool needTag = isValueTagNeeded();
     markWrite();
-    writeValueTag(os_, needTag, svint_tag);
-    writeSvint(os_, val);
+    writeValueTag(needTag, svint_tag);
+    out_.writeSvint(val);
   }
 
-  void emitString(const std::string &val) {
+  void emitString(const char *val, size_t size) {
     bool needTag = isValueTagNeeded();
     markWrite();
-    writeValueTag(os_, needTag, string_tag);
-    writeUvint(os_, val.length());
-    for (const char &c : val) {
-      write8(os_, c);
-    }
+    writeValueTag(needTag, string_tag);
+    out_.writeUvint(size);
+    out_.writeBytes(val, size);
   }
 
-  void emitTag(const std::string &val) {
-    int32_t hash = biniou_hash(val);
+  void emitTag(const Tag &val) {
+    int32_t hash = val.hash();
     // set first bit of hash
     hash |= 1 << 31;
     markWrite();
-    write32(os_, hash);
+    out_.write32(hash);
   }
 
-  void emitVariantTag(const std::string &val, bool hasArg) {
-    int32_t hash = biniou_hash(val);
+  void emitVariantTag(const Tag &val, bool hasArg) {
+    int32_t hash = val.hash();
     // set first bit of hash if the variant has an argument
     if (hasArg) {
       hash |= 1 << 31;
     }
     markWrite();
-    write32(os_, hash);
+    out_.write32(hash);
   }
 
   void enterArray(int size) { enterContainer(ARRAY_tag, size); }
-  // unsupported:
-  // void enterArray() { enterContainer(ARRAY_tag); }
+  void enterArray() { enterContainer(ARRAY_tag, SIZE_PATCHED); }
   void leaveArray() { leaveContainer(); }
-  void enterObject(int size) { enterContainer(RECORD_tag, size); }
-  // unsupported:
-  // void enterObject() { enterContainer(RECORD_tag); }
+  void enterObject(int size) {
+    enterContainer(RECORD_tag, streamContainers_ ? SIZE_PATCHED : size);
+  }
+  void enterObject() { enterContainer(RECORD_tag, SIZE_PATCHED); }
   void leaveObject() {
     const ATDContainer &obj = atdContainers.back();
     // Container's size was already written -> must fill in for missing
@@ -659,8 +1160,7 @@ class BiniouEmitter {
     leaveContainer();
   }
   void enterTuple(int size) { enterContainer(TUPLE_tag, size); }
-  // unsupported:
-  // void enterTuple() { enterContainer(TUPLE_tag); }
+  void enterTuple() { enterContainer(TUPLE_tag, SIZE_PATCHED); }
   void leaveTuple() { leaveContainer(); }
   void enterVariant() { enterContainer(VARIANT_tag, SIZE_NOT_NEEDED); }
   void leaveVariant() { leaveContainer(); }
@@ -673,7 +1173,7 @@ class JsonWriter : public GenWriter<JsonEmitter<OStream>> {
 
  public:
   JsonWriter(OStream &os, const ATDWriterOptions opts)
-      : GenWriter<Emitter>(Emitter(os, opts)) {}
+      : GenWriter<Emitter>(Emitter(os, opts), opts.internStrings) {}
 };
 
 // The full class for biniou writing
@@ -685,6 +1185,7 @@ class BiniouWriter : public GenWriter<BiniouEmitter<OStream>> {
   BiniouWriter(OStream &os) : GenWriter<Emitter>(Emitter(os)) {}
 
   BiniouWriter(OStream &os, const ATDWriterOptions opts)
-      : GenWriter<Emitter>(Emitter(os)) {}
+      : GenWriter<Emitter>(Emitter(os, opts.streamContainers),
+                           opts.internStrings) {}
 };
 } // namespace ATDWriter
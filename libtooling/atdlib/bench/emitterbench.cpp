@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Microbenchmarks of the emitters: synthetic streams of events are written
+// to an in-memory sink, and the throughput is reported in events and bytes
+// per second. Usage: emitterbench [scale], where scale sets the size of the
+// values written by each workload.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "../ATDWriter.h"
+
+// Buffered sink in the manner of llvm::raw_ostream: bytes are copied to a
+// buffer which is recycled when full
+class BufferStream {
+  static const size_t BUFFER_SIZE = 64 * 1024;
+  char buffer_[BUFFER_SIZE];
+  size_t pos_;
+  uint64_t flushed_;
+  uint64_t checksum_;
+
+  void flush() {
+    for (size_t i = 0; i < pos_; i += 4096) {
+      checksum_ = checksum_ * 31 + buffer_[i];
+    }
+    flushed_ += pos_;
+    pos_ = 0;
+  }
+
+ public:
+  BufferStream() : pos_(0), flushed_(0), checksum_(0) {}
+
+  BufferStream &write(const char *data, size_t size) {
+    while (size > BUFFER_SIZE - pos_) {
+      size_t n = BUFFER_SIZE - pos_;
+      memcpy(buffer_ + pos_, data, n);
+      pos_ += n;
+      data += n;
+      size -= n;
+      flush();
+    }
+    memcpy(buffer_ + pos_, data, size);
+    pos_ += size;
+    return *this;
+  }
+  BufferStream &operator<<(const char *str) { return write(str, strlen(str)); }
+  BufferStream &operator<<(char c) { return write(&c, 1); }
+  uint64_t tell() const { return flushed_ + pos_; }
+  uint64_t checksum() {
+    flush();
+    return checksum_;
+  }
+};
+
+typedef ATDWriter::JsonWriter<BufferStream> JsonWriter;
+typedef ATDWriter::BiniouWriter<BufferStream> BiniouWriter;
+
+// Each workload writes one top-level value and returns its number of events,
+// i.e. of calls to the writer
+
+// arrays nested in variants and tuples, down to a depth of 500
+template <class Writer>
+uint64_t deepNesting(Writer &OF, int scale) {
+  const int depth = 500;
+  uint64_t events = 0;
+  typename Writer::ArrayScope Scope(OF, 20 * scale);
+  events += 2;
+  for (int i = 0; i < 20 * scale; i++) {
+    for (int d = 0; d < depth; d++) {
+      OF.enterVariant("Nested");
+      OF.enterTuple(2);
+      OF.emitInteger(d);
+      OF.enterArray(1);
+    }
+    OF.emitSimpleVariant("Leaf");
+    for (int d = 0; d < depth; d++) {
+      OF.leaveArray();
+      OF.leaveTuple();
+      OF.leaveVariant();
+    }
+    events += 7 * depth + 1;
+  }
+  return events;
+}
+
+// one array of many integers
+template <class Writer>
+uint64_t wideArray(Writer &OF, int scale) {
+  const int size = 200000 * scale;
+  typename Writer::ArrayScope Scope(OF, size);
+  for (int i = 0; i < size; i++) {
+    OF.emitInteger(i * 7919);
+  }
+  return size + 2;
+}
+
+// long strings, half of them with characters to escape
+template <class Writer>
+uint64_t longStrings(Writer &OF, int scale) {
+  const int count = 500 * scale;
+  std::string plain(4096, 'a');
+  std::string escaped;
+  while (escaped.size() < 4096) {
+    escaped += "path\\to\\\"file\".c\n\t";
+  }
+  typename Writer::ArrayScope Scope(OF, count);
+  for (int i = 0; i < count; i++) {
+    OF.emitString(i % 2 ? escaped : plain);
+  }
+  return count + 2;
+}
+
+// records of small integers and flags, as in the infos of AST nodes
+template <class Writer>
+uint64_t smallRecords(Writer &OF, int scale) {
+  const int count = 50000 * scale;
+  typename Writer::ArrayScope Scope(OF, count);
+  for (int i = 0; i < count; i++) {
+    typename Writer::ObjectScope Scope(OF, 4);
+    OF.emitTag("pointer");
+    OF.emitInteger(i);
+    OF.emitTag("line");
+    OF.emitInteger(i % 1000);
+    OF.emitTag("column");
+    OF.emitInteger(i % 80);
+    OF.emitFlag("is_implicit", i % 3 == 0);
+  }
+  return 2 + (uint64_t)count * 9;
+}
+
+const double MIN_SECONDS = 0.5;
+
+template <class Writer>
+struct Workload {
+  const char *name;
+  uint64_t (*run)(Writer &, int);
+};
+
+template <class Writer>
+void runWorkloads(const char *format,
+                  const ATDWriter::ATDWriterOptions &options,
+                  int scale) {
+  const Workload<Writer> workloads[] = {
+      {"deep_nesting", deepNesting<Writer>},
+      {"wide_array", wideArray<Writer>},
+      {"long_strings", longStrings<Writer>},
+      {"small_records", smallRecords<Writer>},
+  };
+  for (const auto &workload : workloads) {
+    BufferStream os;
+    uint64_t events = 0;
+    int runs = 0;
+    double seconds;
+    auto start = std::chrono::steady_clock::now();
+    // repeat the workload for long enough to be measured
+    do {
+      {
+        Writer OF(os, options);
+        events += workload.run(OF, scale);
+      }
+      runs++;
+      seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    } while (seconds < MIN_SECONDS);
+    uint64_t bytes = os.tell();
+    printf("%-16s %-14s %5d runs %10.1fM events/s %8.1fMB/s  (%llx)\n",
+           format,
+           workload.name,
+           runs,
+           events / seconds / 1e6,
+           bytes / seconds / 1e6,
+           (unsigned long long)os.checksum());
+  }
+}
+
+int main(int argc, char **argv) {
+  int scale = argc > 1 ? atoi(argv[1]) : 10;
+  const struct ATDWriter::ATDWriterOptions jsonOptions = {
+      .useYojson = false,
+      .prettifyJson = true,
+      .streamContainers = false,
+  };
+  const struct ATDWriter::ATDWriterOptions compactJsonOptions = {
+      .useYojson = false,
+      .prettifyJson = false,
+      .streamContainers = false,
+  };
+  const struct ATDWriter::ATDWriterOptions biniouOptions = {
+      .useYojson = false,
+      .prettifyJson = false,
+      .streamContainers = false,
+  };
+  const struct ATDWriter::ATDWriterOptions streamedBiniouOptions = {
+      .useYojson = false,
+      .prettifyJson = false,
+      .streamContainers = true,
+  };
+
+  runWorkloads<JsonWriter>("json", jsonOptions, scale);
+  runWorkloads<JsonWriter>("json_compact", compactJsonOptions, scale);
+  runWorkloads<BiniouWriter>("biniou", biniouOptions, scale);
+  runWorkloads<BiniouWriter>("biniou_streamed", streamedBiniouOptions, scale);
+
+  return 0;
+}
@@ -12,6 +12,15 @@ typedef JsonWriter::ArrayScope ArrayScope;
 typedef JsonWriter::VariantScope VariantScope;
 typedef JsonWriter::TupleScope TupleScope;
 
+// string-like value not owning its characters, in the manner of
+// llvm::StringRef
+struct StringView {
+  const char *data_;
+  size_t size_;
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+};
+
 int main(int argc, char **argv) {
   const struct ATDWriter::ATDWriterOptions jsonWriterOptions = {
       .useYojson = false,
@@ -98,6 +107,83 @@ int main(int argc, char **argv) {
       }
     }
   }
+  {
+    JsonWriter OF(std::cout, jsonWriterOptions);
+    ArrayScope Scope(OF, 3);
+    OF.emitString("a long string without any character to be escaped");
+    OF.emitString("\\path\\to\\\"file\".c\r\n");
+    OF.emitString(std::string("\x01\x1f\x7f\0<-nul", 9));
+  }
+  {
+    JsonWriter OF(std::cout, jsonWriterOptions);
+    const char *chars = "view of a longer string";
+    ArrayScope Scope(OF, 3);
+    OF.emitString(chars, 4);
+    OF.emitString(StringView{chars + 10, 6});
+    OF.emitSimpleVariant(ATDWriter::Tag(chars + 17, 6));
+  }
+  {
+    JsonWriter OF(std::cout, jsonWriterOptions);
+    {
+      ArrayScope Scope(OF, 1);
+      OF.emitInteger(1);
+    }
+    OF.emitEndOfValue();
+    {
+      ArrayScope Scope(OF, 1);
+      OF.emitInteger(2);
+    }
+  }
+  {
+    const struct ATDWriter::ATDWriterOptions internedWriterOptions = {
+        .useYojson = false,
+        .prettifyJson = true,
+        .internStrings = true,
+    };
+    JsonWriter OF(std::cout, internedWriterOptions);
+    {
+      ArrayScope Scope(OF, 10);
+      OF.emitString("/path/to/file.h");
+      OF.emitString("short");
+      OF.emitString("short");
+      OF.emitString("\x01marked string");
+      OF.emitString("/path/to/file.h");
+      OF.emitString("\x01marked string");
+      // constructors take a number before the next references
+      {
+        VariantScope Variant(OF, "VariantWithArg");
+        OF.emitString("/path/to/file.h");
+      }
+      OF.emitSimpleVariant("SimpleVariant");
+      OF.emitString("/path/to/other/file.h");
+      OF.emitString("/path/to/other/file.h");
+    }
+    OF.emitEndOfValue();
+    {
+      ArrayScope Scope(OF, 2);
+      OF.emitString("/path/to/file.h");
+      OF.emitString("/path/to/file.h");
+    }
+  }
+  {
+    const struct ATDWriter::ATDWriterOptions internedWriterOptions = {
+        .useYojson = true,
+        .prettifyJson = true,
+        .internStrings = true,
+    };
+    JsonWriter OF(std::cout, internedWriterOptions);
+    {
+      // Yojson variants are not strings of the output
+      ArrayScope Scope(OF, 4);
+      {
+        VariantScope Variant(OF, "VariantWithArg");
+        OF.emitString("/path/to/file.h");
+      }
+      OF.emitSimpleVariant("SimpleVariant");
+      OF.emitString("/path/to/other/file.h");
+      OF.emitString("/path/to/other/file.h");
+    }
+  }
 
   return 0;
 }
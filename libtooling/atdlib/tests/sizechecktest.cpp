@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+// Always built without DEBUG: the size mismatches below would fire asserts
+#include "../ATDWriter.h"
+
+typedef ATDWriter::JsonWriter<std::ostream> JsonWriter;
+typedef JsonWriter::ObjectScope ObjectScope;
+typedef JsonWriter::ArrayScope ArrayScope;
+typedef JsonWriter::VariantScope VariantScope;
+typedef JsonWriter::TupleScope TupleScope;
+
+static const char *symbolName(enum ATDWriter::Symbol s) {
+  switch (s) {
+  case ATDWriter::SARRAY:
+    return "array";
+  case ATDWriter::STUPLE:
+    return "tuple";
+  case ATDWriter::SOBJECT:
+    return "object";
+  case ATDWriter::SVARIANT:
+    return "variant";
+  case ATDWriter::STAG:
+    return "tag";
+  }
+  return "";
+}
+
+static void report(JsonWriter &OF) {
+  OF.emitEndOfValue();
+  const ATDWriter::SizeError *error = OF.sizeError();
+  if (!error) {
+    std::cout << "no size error\n";
+    return;
+  }
+  std::cout << "size error in " << symbolName(error->container) << " of '"
+            << error->variant << "': " << error->actual << " elements, "
+            << (error->atMost ? "at most " : "") << error->expected
+            << " expected\n";
+}
+
+int main(int argc, char **argv) {
+  const struct ATDWriter::ATDWriterOptions jsonWriterOptions = {
+      .useYojson = false,
+      .prettifyJson = false,
+  };
+
+  {
+    // well-formed
+    JsonWriter OF(std::cout, jsonWriterOptions);
+    OF.enableSizeChecks();
+    {
+      VariantScope Scope(OF, "Node");
+      TupleScope tScope(OF, 2);
+      OF.emitInteger(1);
+      ObjectScope oScope(OF, 3);
+      OF.emitTag("a");
+      OF.emitInteger(2);
+    }
+    report(OF);
+  }
+  {
+    // the tuple of Inner misses an element, the one of Outer is correct
+    JsonWriter OF(std::cout, jsonWriterOptions);
+    OF.enableSizeChecks();
+    {
+      VariantScope Scope(OF, "Outer");
+      TupleScope tScope(OF, 2);
+      OF.emitString("x");
+      {
+        VariantScope Scope(OF, "Inner");
+        TupleScope tScope(OF, 3);
+        OF.emitInteger(1);
+        OF.emitInteger(2);
+      }
+    }
+    report(OF);
+  }
+  {
+    // the object has more fields than announced, only the first error is kept
+    JsonWriter OF(std::cout, jsonWriterOptions);
+    OF.enableSizeChecks();
+    {
+      ArrayScope Scope(OF, 1);
+      {
+        ObjectScope oScope(OF, 1);
+        OF.emitTag("a");
+        OF.emitInteger(1);
+        OF.emitTag("b");
+        OF.emitInteger(2);
+      }
+      OF.emitInteger(3);
+    }
+    report(OF);
+  }
+  {
+    // checks are off by default
+    JsonWriter OF(std::cout, jsonWriterOptions);
+    {
+      ArrayScope Scope(OF, 2);
+      OF.emitInteger(1);
+    }
+    report(OF);
+  }
+
+  return 0;
+}
@@ -0,0 +1,6 @@
+#/bin/bash
+# Copyright (c) 2014-present, Facebook, Inc.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+"$@" | "$(dirname "$0")"/../../../scripts/print_frames.py -
@@ -0,0 +1,13 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#include "decl_path_filter.h"
+
+int first(int x) {
+  return x;
+}
+
+int second(int x) { return kept_in_header(x) + first(x); }
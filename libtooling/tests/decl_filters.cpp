@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+namespace ns { // kept, as its decls are filtered
+int kept();
+int dropped();
+} // namespace ns
+
+extern "C" { // kept, as its decls are filtered
+int kept_c();
+int dropped_c();
+}
+
+// unscoped enums are transparent contexts, but filtered like other decls
+enum KeptEnum { KEPT_CONSTANT };
+enum DroppedEnum { DROPPED_CONSTANT };
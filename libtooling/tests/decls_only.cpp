@@ -0,0 +1,16 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+struct S {
+  int method() {
+    return 1;
+  }
+};
+
+int function(int x) {
+  S s;
+  return s.method() + x;
+}
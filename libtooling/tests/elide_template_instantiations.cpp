@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+template <typename T>
+struct Box {
+  T value;
+  T get() const {
+    return value;
+  }
+};
+
+int unbox(Box<int> b) {
+  return b.get();
+}
@@ -0,0 +1,10 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+int repeated_name;
+int other_name() {
+  return repeated_name + repeated_name;
+}
@@ -0,0 +1,68 @@
+#!/bin/bash
+
+# Copyright (c) 2014-present, Facebook, Inc.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# End-to-end test of ast_exporter_bin -j, run from libtooling:
+# jobs_test.sh AST_EXPORTER_BIN
+# The compile commands run in other directories than the one of the tool, so
+# that relative paths only resolve against the working directory of each
+# compiler.
+
+BIN="$1"
+DIR="$PWD/build/jobs_test"
+
+rm -rf "$DIR"
+for D in a b; do
+  mkdir -p "$DIR/$D/inc"
+  echo "int $D;" > "$DIR/$D/inc/header.h"
+  printf '#include "header.h"\nint main_%s() { return %s; }\n' $D $D \
+    > "$DIR/$D/main.c"
+done
+python3 - "$DIR" <<'PY'
+import json, os, sys
+root = sys.argv[1]
+json.dump([{'directory': os.path.join(root, d),
+            'file': 'main.c',
+            'arguments': ['clang', '-Iinc', '-c', 'main.c']}
+           for d in ('a', 'b')],
+          open(os.path.join(root, 'compile_commands.json'), 'w'))
+PY
+
+OPTIONS=(-p "$DIR" -ast-exporter-mode=json
+         -ast-exporter-option=PREPEND_CURRENT_DIR=1
+         -ast-exporter-option=MAKE_RELATIVE_TO="$DIR")
+
+for D in a b; do
+  "$BIN" "${OPTIONS[@]}" -ast-exporter-output="$DIR/$D.json" "$DIR/$D/main.c" \
+    || echo "sequential export of $D failed"
+done
+"$BIN" "${OPTIONS[@]}" -j 2 -ast-exporter-output="$DIR/out" \
+  "$DIR/a/main.c" "$DIR/b/main.c" || echo "parallel export failed"
+
+for D in a b; do
+  echo "-- $D --"
+  # the source files of the declarations
+  python3 - "$DIR/$D.json" <<'PY'
+import json, sys
+files = set()
+def walk(node):
+    if isinstance(node, dict):
+        if isinstance(node.get('file'), str):
+            files.add(node['file'])
+        for value in node.values():
+            walk(value)
+    elif isinstance(node, list):
+        for value in node:
+            walk(value)
+walk(json.load(open(sys.argv[1])))
+print('\n'.join(sorted(files)))
+PY
+  if cmp -s "$DIR/$D.json" "$DIR/out$DIR/$D/main.c.json"; then
+    echo "same output with -j"
+  else
+    echo "different output with -j"
+  fi
+done
@@ -0,0 +1,11 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#include "main_file_only.h"
+
+int in_main_file(KeptInHeader s) {
+  return referenced_in_header(s.field);
+}
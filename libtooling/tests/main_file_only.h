@@ -0,0 +1,11 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+int referenced_in_header(int x);
+int unreferenced_in_header(int x);
+struct KeptInHeader {
+  int field;
+};
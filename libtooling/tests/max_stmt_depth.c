@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+int nested(int x) {
+  if (x > 0) {
+    while (x > 1) {
+      x = x - 1;
+    }
+  }
+  return x;
+}
@@ -0,0 +1,13 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+struct Unreferenced {
+  long field;
+};
+
+int referenced(short x) {
+  return x;
+}
@@ -0,0 +1,95 @@
+#!/bin/bash
+
+# Copyright (c) 2014-present, Facebook, Inc.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# End-to-end test of ast_exporter_bin -ast-exporter-server, run from
+# libtooling: server_test.sh AST_EXPORTER_BIN
+
+BIN="$1"
+CLIENT=../scripts/ast_exporter_client.py
+SOCKET=build/server_test.sock
+LOG=build/server_test.log
+
+rm -f "$SOCKET"
+"$BIN" -ast-exporter-mode=json -ast-exporter-server="$SOCKET" \
+  -ast-exporter-option=PREPEND_CURRENT_DIR=1 \
+  -ast-exporter-option=MAKE_RELATIVE_TO="$PWD" 2> "$LOG" &
+SERVER=$!
+trap 'kill $SERVER 2> /dev/null; rm -f "$SOCKET"' EXIT
+for i in $(seq 100); do
+  [ -S "$SOCKET" ] && break
+  sleep 0.1
+done
+
+python3 -c 'import os, sys; print("socket mode %o" % (os.stat(sys.argv[1]).st_mode & 0o777))' "$SOCKET"
+
+export_kind() {
+  "$CLIENT" --socket "$SOCKET" --output build/server_test.json "$@" 2>&1
+  echo "exit $?"
+  if [ -s build/server_test.json ]; then
+    python3 -c 'import json, sys; print(json.load(open(sys.argv[1]))[0])' build/server_test.json
+  fi
+  rm -f build/server_test.json
+}
+
+echo "-- export --"
+export_kind clang -c tests/c_attributes.c
+
+# the source files of the declarations, relative to libtooling
+source_files() {
+  "$CLIENT" --socket "$SOCKET" --output build/server_test.json "$@" 2>&1
+  echo "exit $?"
+  python3 - build/server_test.json <<'PY'
+import json, sys
+files = set()
+def walk(node):
+    if isinstance(node, dict):
+        if isinstance(node.get('file'), str):
+            files.add(node['file'])
+        for value in node.values():
+            walk(value)
+    elif isinstance(node, list):
+        for value in node:
+            walk(value)
+walk(json.load(open(sys.argv[1])))
+print('\n'.join(sorted(f for f in files if f)))
+PY
+  rm -f build/server_test.json
+}
+
+echo "-- export from another directory --"
+source_files --directory "$PWD/tests" clang -c c_attributes.c
+
+echo "-- missing source --"
+export_kind clang -c tests/missing.c
+
+echo "-- invalid directory --"
+export_kind --directory /missing clang -c tests/c_attributes.c
+
+echo "-- invalid request --"
+export_kind
+
+echo "-- oversized request --"
+python3 - "$SOCKET" <<'PY'
+import socket, sys
+sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+sock.connect(sys.argv[1])
+reply = b''
+try:
+    sock.sendall(b'/\n' + b'x' * (8 << 20) + b'\n\n')
+    while True:
+        chunk = sock.recv(1 << 16)
+        if not chunk:
+            break
+        reply += chunk
+except OSError:
+    # the server closed the connection without reading the whole request
+    pass
+print('rejected' if reply in (b'', b'\0' * 11 + b'\1ASTREPLY') else 'accepted')
+PY
+
+echo "-- export after errors --"
+export_kind clang -c tests/c_attributes.c
@@ -0,0 +1,8 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+const char *short_literal = "short";
+const char *long_literal = "longer than the threshold of the test";
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "../../FileUtils.h"
+
+static void normalize(llvm::StringRef path) {
+  llvm::SmallString<64> result(path);
+  FileUtils::normalizePath(result);
+  llvm::outs() << "normalizePath(\"" << path << "\") = \"" << result
+               << "\"\n";
+}
+
+static void absolute(llvm::StringRef cwd, llvm::StringRef path) {
+  llvm::SmallString<64> result;
+  FileUtils::makeAbsolutePath(cwd, path, result);
+  llvm::outs() << "makeAbsolutePath(\"" << cwd << "\", \"" << path
+               << "\") = \"" << result << "\"\n";
+}
+
+static void relative(const std::string &repoRoot,
+                     const std::string &sysRoot,
+                     bool keepExternalPaths,
+                     bool allowSiblingsToRoot,
+                     const std::string &path) {
+  llvm::outs() << "makeRelativePath(\"" << repoRoot << "\", \"" << sysRoot
+               << "\", " << keepExternalPaths << ", " << allowSiblingsToRoot
+               << ", \"" << path << "\") = \""
+               << FileUtils::makeRelativePath(repoRoot,
+                                              sysRoot,
+                                              keepExternalPaths,
+                                              allowSiblingsToRoot,
+                                              path)
+               << "\"\n";
+}
+
+int main() {
+  // usual paths
+  normalize("");
+  normalize("/");
+  normalize("a");
+  normalize("/a/b/c.h");
+  normalize("a/b/c.h");
+  normalize("/a//b///c.h");
+  normalize("/a/./b/./c.h");
+  normalize("/a/b/../c.h");
+  normalize("a/b/../../c.h");
+  normalize("a/b/");
+  normalize("/a/b//");
+  normalize("../a/b");
+  normalize("../../a/../b");
+  normalize("./a");
+  normalize("...");
+  normalize("/a/.../b");
+  normalize("/a/..b/c");
+  // trailing "." and ".."
+  normalize("/a/b/.");
+  normalize("/a/b/..");
+  normalize("a/b/.");
+  normalize("a/b/..");
+  normalize("a/..");
+  normalize(".");
+  normalize("./.");
+  normalize("/a/b/../..");
+  // ".." above the root
+  normalize("/..");
+  normalize("/../a");
+  normalize("/a/../../b");
+  normalize("/../../a/./b/..");
+  normalize("..");
+  normalize("a/../..");
+  normalize("a/../../b");
+
+  absolute("/repo", "a/b.h");
+  absolute("/repo/", "./a/../b.h");
+  absolute("/repo/src", "../../../b.h");
+  absolute("/repo", "/usr/include/../lib/c.h");
+  absolute("", "a/./b.h");
+
+  relative("/repo", "", false, false, "/repo/a/b.h");
+  relative("/repo", "", false, false, "/other/b.h");
+  relative("/repo", "", true, false, "/other/b.h");
+  relative("/work/repo", "", false, true, "/work/lib/b.h");
+  relative("/repo", "/sdk", false, false, "/sdk/usr/include/b.h");
+  return 0;
+}
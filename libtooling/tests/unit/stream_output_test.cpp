@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <llvm/Support/raw_ostream.h>
+
+#include "../../SimplePluginASTAction.h"
+
+// Stream outputs whose consumer goes away must fail without SIGPIPE killing
+// the process.
+
+static const int OutputFd = 100;
+static const char *SocketPath = "build/stream_output_test.sock";
+
+static void writeLots(llvm::raw_ostream &OS) {
+  std::string chunk(1 << 16, 'x');
+  for (int i = 0; i < 64; i++) {
+    OS << chunk;
+  }
+}
+
+static void section(const char *name) {
+  llvm::outs() << "-- " << name << " --\n";
+  llvm::outs().flush();
+}
+
+int main() {
+  int fds[2];
+
+  section("pipe");
+  if (pipe(fds) != 0 || dup2(fds[1], OutputFd) < 0) {
+    return 1;
+  }
+  close(fds[1]);
+  {
+    auto OS = ASTPluginLib::openStreamOutput("fd:100");
+    *OS << "hello";
+  }
+  close(OutputFd);
+  char buf[16] = {0};
+  ssize_t n = read(fds[0], buf, sizeof(buf) - 1);
+  close(fds[0]);
+  llvm::outs() << "read " << n << " bytes: " << buf << "\n";
+
+  section("closed pipe");
+  if (pipe(fds) != 0 || dup2(fds[1], OutputFd) < 0) {
+    return 1;
+  }
+  close(fds[1]);
+  close(fds[0]);
+  {
+    auto OS = ASTPluginLib::openStreamOutput("fd:100");
+    writeLots(*OS);
+  }
+  close(OutputFd);
+
+  section("closed socket");
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, SocketPath, sizeof(addr.sun_path) - 1);
+  unlink(SocketPath);
+  if (listener < 0 ||
+      bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listener, 1) != 0) {
+    return 1;
+  }
+  {
+    auto OS = ASTPluginLib::openStreamOutput(std::string("unix:") + SocketPath);
+    close(accept(listener, nullptr, nullptr));
+    writeLots(*OS);
+  }
+  close(listener);
+  unlink(SocketPath);
+
+  section("missing socket");
+  if (!ASTPluginLib::openStreamOutput(std::string("unix:") + SocketPath)) {
+    llvm::outs() << "no output\n";
+  }
+
+  llvm::outs() << "done\n";
+  return 0;
+}
@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2014-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+namespace ns {
+int in_namespace(int x);
+}
+
+struct S {
+  int method(int y);
+};
+
+int top_level(int z) {
+  S s;
+  return ns::in_namespace(z) + s.method(z);
+}
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2014-present, Facebook, Inc.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import sys
+import argparse
+import os
+import socket
+import struct
+
+"""
+Send a compile command to `ast_exporter_bin -ast-exporter-server=SOCKET` and
+write the export received back. See runServerWorker in
+libtooling/ast_exporter_bin.cpp.
+"""
+
+MAGIC = b'ASTREPLY'
+TRAILER_SIZE = 20
+STATUSES = {
+    0: 'exported',
+    1: 'invalid request',
+    2: 'invalid directory',
+    3: 'export failed',
+}
+
+
+def request(socket_path, directory, command):
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(socket_path)
+    with sock:
+        lines = [directory] + command + ['', '']
+        sock.sendall('\n'.join(lines).encode())
+        chunks = []
+        while True:
+            chunk = sock.recv(1 << 16)
+            if not chunk:
+                break
+            chunks.append(chunk)
+    return b''.join(chunks)
+
+
+# Returns the export and the status of a reply, or exits if it is truncated
+def parse_reply(reply):
+    if len(reply) < TRAILER_SIZE or reply[-8:] != MAGIC:
+        sys.exit('truncated reply')
+    size, status = struct.unpack('>QI', reply[-TRAILER_SIZE:-8])
+    if size != len(reply) - TRAILER_SIZE:
+        sys.exit('truncated reply: %d bytes instead of %d' %
+                 (len(reply) - TRAILER_SIZE, size))
+    return reply[:size], status
+
+
+def main():
+    arg_parser = argparse.ArgumentParser(description='Export a compile command with an ast_exporter_bin server')
+    arg_parser.add_argument('--socket', required=True)
+    arg_parser.add_argument('--directory', default=os.getcwd(),
+                        help='working directory of the command')
+    arg_parser.add_argument('--output', help='defaults to the standard output')
+    arg_parser.add_argument('command', nargs=argparse.REMAINDER,
+                        help='compile command, the compiler included')
+    args = arg_parser.parse_args()
+
+    export, status = parse_reply(
+        request(args.socket, args.directory, args.command))
+    if status != 0:
+        sys.exit(STATUSES.get(status, 'unknown status %d' % status))
+    if args.output:
+        with open(args.output, 'wb') as f:
+            f.write(export)
+    else:
+        sys.stdout.buffer.write(export)
+
+
+if __name__ == '__main__':
+    main()
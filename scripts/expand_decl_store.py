@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2014-present, Facebook, Inc.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import sys
+import argparse
+import os
+import struct
+
+"""
+Replace the reference frames of a framed output exported with DECL_STORE_DIR
+by the frames of the store, which gives back a self-contained output. See
+libtooling/DeclStore.h. With WRITE_INDEX, the offsets of the index are moved
+along with the frames, see ASTExporter::dumpFrameIndex.
+"""
+
+MAGIC = b'ASTSTORE'
+DIGEST_SIZE = 32
+INDEX_MAGIC = b'ASTINDEX'
+
+
+def read_frames(f):
+    while True:
+        header = f.read(4)
+        if not header:
+            return
+        if len(header) != 4:
+            sys.exit('truncated frame header')
+        (size,) = struct.unpack('>I', header)
+        frame = f.read(size)
+        if len(frame) != size:
+            sys.exit('truncated frame')
+        yield frame
+
+
+def expand(frame, store_dir):
+    if len(frame) != len(MAGIC) + DIGEST_SIZE or not frame.startswith(MAGIC):
+        return frame
+    digest = frame[len(MAGIC):].decode('ascii')
+    with open(os.path.join(store_dir, digest), 'rb') as f:
+        return f.read()
+
+
+def is_index(frame, offset):
+    if len(frame) < 16 or not frame.endswith(INDEX_MAGIC):
+        return False
+    (index_offset,) = struct.unpack('>Q', frame[-16:-8])
+    return index_offset == offset
+
+
+# The index with the offsets of the frames moved to their new ones
+def rebase_index(frame, new_offsets, index_offset):
+    out = bytearray()
+    pos = 0
+    for _ in range(2):
+        (num,) = struct.unpack_from('>I', frame, pos)
+        out += frame[pos:pos + 4]
+        pos += 4
+        for _ in range(num):
+            key, offset = struct.unpack_from('>QQ', frame, pos)
+            out += struct.pack('>QQ', key, new_offsets[offset])
+            pos += 16
+    out += struct.pack('>Q', index_offset)
+    out += INDEX_MAGIC
+    return bytes(out)
+
+
+def main():
+    arg_parser = argparse.ArgumentParser(description='Expand the references to a decl store in a framed output')
+    arg_parser.add_argument("--store", required=True, help="Directory given as DECL_STORE_DIR")
+    arg_parser.add_argument(metavar="INPUT", dest="input_file", help="Framed output")
+    arg_parser.add_argument(metavar="OUTPUT", dest="output_file", help="Expanded framed output")
+    args = arg_parser.parse_args()
+    with open(args.input_file, 'rb') as inp, open(args.output_file, 'wb') as out:
+        # offset of each frame in the input, to the one in the output
+        new_offsets = {}
+        offset = 0
+        for frame in read_frames(inp):
+            new_offsets[offset] = out.tell()
+            if is_index(frame, offset):
+                expanded = rebase_index(frame, new_offsets, out.tell())
+            else:
+                expanded = expand(frame, args.store)
+            offset += 4 + len(frame)
+            out.write(struct.pack('>I', len(expanded)))
+            out.write(expanded)
+
+
+if __name__ == '__main__':
+    main()
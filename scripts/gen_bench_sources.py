@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2014-present, Facebook, Inc.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import sys
+import argparse
+
+"""
+Generate large translation units for the export benchmarks
+(see `make -C libtooling bench`).
+The kind of source is given by the extension of the output file.
+"""
+
+# heavy templates: each container is instantiated for every element type, and
+# every member function is used so that the instantiations have bodies
+def templates(out, scale):
+    n_types = 50 * scale
+    out.write('''
+template <class T> struct Box {
+  T value;
+  Box() : value() {}
+  explicit Box(const T &v) : value(v) {}
+  template <class U> Box<U> map(U (*f)(const T &)) const {
+    return Box<U>(f(value));
+  }
+};
+
+template <class T, int N> struct Array {
+  T data[N];
+  int size() const { return N; }
+  T &operator[](int i) { return data[i]; }
+  template <class F> void each(F f) {
+    for (int i = 0; i < N; i++) {
+      f(data[i]);
+    }
+  }
+};
+
+template <int N> struct Fib {
+  static const long value = Fib<N - 1>::value + Fib<N - 2>::value;
+};
+template <> struct Fib<1> { static const long value = 1; };
+template <> struct Fib<0> { static const long value = 0; };
+
+template <class... Ts> struct Tuple;
+template <> struct Tuple<> {};
+template <class T, class... Ts> struct Tuple<T, Ts...> : Tuple<Ts...> {
+  T head;
+};
+''')
+    for i in range(n_types):
+        out.write('''
+struct S%(i)d {
+  int x%(i)d;
+  double y%(i)d;
+  bool operator<(const S%(i)d &o) const { return x%(i)d < o.x%(i)d; }
+};
+inline int key%(i)d(const S%(i)d &s) { return s.x%(i)d; }
+int use%(i)d() {
+  Array<S%(i)d, %(n)d> a;
+  int sum = 0;
+  a.each([&sum](S%(i)d &s) { sum += s.x%(i)d; });
+  Box<S%(i)d> b(a[0]);
+  Box<int> k = b.map(key%(i)d);
+  Tuple<S%(i)d, Box<S%(i)d>, Array<int, %(n)d>> t;
+  return sum + k.value + a.size() + (int)Fib<%(fib)d>::value + t.head.x%(i)d;
+}
+''' % {'i': i, 'n': i % 7 + 1, 'fib': i % 40 + 2})
+
+
+# big Objective-C headers, without Foundation so that no SDK is needed
+def objc_headers(out, scale):
+    n_classes = 20 * scale
+    out.write('''
+__attribute__((objc_root_class))
+@interface Root
++ (instancetype)alloc;
+- (instancetype)init;
+@end
+
+@protocol Observer
+- (void)objectDidChange:(id)object;
+@optional
+- (void)objectWillChange:(id)object;
+@end
+''')
+    for i in range(n_classes):
+        parent = 'Root' if i == 0 else 'C%d' % (i - 1)
+        out.write('\n/// Documented class %d\n' % i)
+        out.write('@interface C%d : %s <Observer>\n' % (i, parent))
+        for j in range(20):
+            out.write('@property(nonatomic) int p%d_%d;\n' % (i, j))
+            out.write('- (int)m%d_%d:(int)a with:(C%d *)b;\n' % (i, j, i))
+            out.write('+ (void)c%d_%d:(void (^)(int))block;\n' % (i, j))
+        out.write('@end\n')
+    out.write('''
+@interface Root (Extras)
+- (void)extra;
+@end
+
+@implementation C0
+- (void)objectDidChange:(id)object {
+  void (^block)(int) = ^(int x) {
+    [self objectDidChange:object];
+  };
+  [C0 c0_0:block];
+}
+@end
+''')
+
+
+# huge string literals, dumped in chunks of MAX_STRING_SIZE
+def string_literals(out, scale):
+    n_strings = 8 * scale
+    line = 'the quick brown fox jumps over the lazy dog 0123456789 \\n'
+    for i in range(n_strings):
+        out.write('const char *s%d =\n' % i)
+        for _ in range(2000):
+            out.write('  "%s"\n' % line)
+        out.write(';\n')
+
+
+generators = {
+    'cpp': templates,
+    'm': objc_headers,
+    'c': string_literals,
+}
+
+
+def main():
+    arg_parser = argparse.ArgumentParser(description='Generate a large source file for the export benchmarks')
+    arg_parser.add_argument(metavar="FILE", dest="output_file", help="Output file, ending in " + ", ".join("." + ext for ext in sorted(generators)))
+    arg_parser.add_argument("--scale", type=int, default=10, help="Size factor of the generated code (default: 10)")
+    args = arg_parser.parse_args()
+    ext = args.output_file.rsplit('.', 1)[-1]
+    if ext not in generators:
+        sys.exit("unknown kind of source: " + args.output_file)
+    with open(args.output_file, "w") as out:
+        generators[ext](out, args.scale)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2014-present, Facebook, Inc.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import sys
+import argparse
+import json
+import struct
+
+from expand_decl_store import read_frames, is_index
+
+"""
+Print a framed output as text, each frame after a line giving its offset, so
+that tests can compare it with their expected output. See
+libtooling/FramedOutputStream.h. With --lookup-index, print instead the decl
+that each entry of the index written with WRITE_INDEX points to, decoding
+only the frame at its offset, see ASTExporter::dumpFrameIndex.
+"""
+
+
+def read_index(frame):
+    entries = []
+    pos = 0
+    for _ in range(2):
+        (num,) = struct.unpack_from('>I', frame, pos)
+        pos += 4
+        entries.append([struct.unpack_from('>QQ', frame, pos + 16 * i) for i in range(num)])
+        pos += 16 * num
+    return entries
+
+
+# The decl of a JSON AST with the given pointer, if any
+def find_decl(value, pointer):
+    if not isinstance(value, list):
+        return None
+    if (len(value) == 2 and isinstance(value[0], str) and value[0].endswith('Decl')
+            and isinstance(value[1], list) and value[1] and isinstance(value[1][0], dict)
+            and value[1][0].get('pointer') == pointer):
+        return value
+    for child in value:
+        if isinstance(child, list):
+            found = find_decl(child, pointer)
+            if found is not None:
+                return found
+        elif isinstance(child, dict):
+            for field in child.values():
+                found = find_decl(field, pointer)
+                if found is not None:
+                    return found
+    return None
+
+
+def describe(decl):
+    info = decl[1]
+    if len(info) > 1 and isinstance(info[1], dict) and info[1].get('name'):
+        return '%s %s' % (decl[0], info[1]['name'])
+    return decl[0]
+
+
+# The frame at the given offset of the output, on its own
+def frame_at(data, offset):
+    (size,) = struct.unpack_from('>I', data, offset)
+    return data[offset + 4:offset + 4 + size]
+
+
+def lookup_index(data):
+    (index_offset,) = struct.unpack('>Q', data[-16:-8])
+    index = frame_at(data, index_offset)
+    if not is_index(index, index_offset):
+        sys.exit('no index at the end of the output')
+    decls, mangled_names = read_index(index)
+    for pointer, offset in decls:
+        decl = find_decl(json.loads(frame_at(data, offset).decode('utf-8')), pointer)
+        print('decl %d: frame at offset %d: %s' % (
+            pointer, offset, 'not found' if decl is None else describe(decl)))
+    for _, offset in mangled_names:
+        decl = json.loads(frame_at(data, offset).decode('utf-8'))
+        print('mangled name: frame at offset %d: %s' % (offset, describe(decl)))
+
+
+def main():
+    arg_parser = argparse.ArgumentParser(description='Print the frames of a framed output')
+    arg_parser.add_argument("--lookup-index", action="store_true", help="Print the decls the index points to")
+    arg_parser.add_argument(metavar="INPUT", dest="input_file", help="Framed output, or - for the standard input")
+    args = arg_parser.parse_args()
+    if args.input_file == '-':
+        inp = sys.stdin.buffer
+    else:
+        inp = open(args.input_file, 'rb')
+    if args.lookup_index:
+        lookup_index(inp.read())
+        return
+    offset = 0
+    for frame in read_frames(inp):
+        print('-- frame at offset %d --' % offset)
+        print(frame.decode('utf-8'))
+        offset += 4 + len(frame)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2014-present, Facebook, Inc.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import sys
+import argparse
+import json
+import os
+import subprocess
+import time
+
+"""
+Run an export command and report its wall time, its peak RSS, the size of
+its output and the number of AST nodes exported per second.
+The command must write its output to OUTPUT. It is timed without
+AST_EXPORTER_STATS, whose timers would skew the measures, then run once more
+with it to read the number of nodes from OUTPUT.stats.json.
+"""
+
+STATS_ENV = 'CLANG_FRONTEND_PLUGIN__AST_EXPORTER_STATS'
+
+
+def run(command, stats):
+    env = dict(os.environ)
+    env.pop(STATS_ENV, None)
+    if stats:
+        env[STATS_ENV] = '1'
+    start = time.monotonic()
+    proc = subprocess.Popen(command, env=env)
+    # the usage of this child only, unlike RUSAGE_CHILDREN
+    _, status, usage = os.wait4(proc.pid, 0)
+    wall = time.monotonic() - start
+    proc.returncode = os.WEXITSTATUS(status) if os.WIFEXITED(status) else 128 + os.WTERMSIG(status)
+    # kilobytes on Linux, bytes on macOS
+    rss = usage.ru_maxrss * (1 if sys.platform == 'darwin' else 1024)
+    return proc.returncode, wall, rss
+
+
+def count_nodes(stats_file):
+    with open(stats_file) as f:
+        stats = json.load(f)
+    return sum(node['count']
+               for kind in ('decls', 'stmts', 'types')
+               for node in stats[kind].values())
+
+
+def format_result(r):
+    return '%-20s %-28s %8.2fs %8.1fMB %9.1fMB %10.0f nodes/s' % (
+        r['plugin'], r['source'], r['wall_s'], r['rss_bytes'] / 1e6,
+        r['output_bytes'] / 1e6, r['nodes_per_s'])
+
+
+def main():
+    arg_parser = argparse.ArgumentParser(description='Benchmark an export command')
+    arg_parser.add_argument("--plugin", required=True, help="Name of the plugin, for the report")
+    arg_parser.add_argument("--source", required=True, help="Name of the exported source, for the report")
+    arg_parser.add_argument("--output", required=True, help="Output file of the command")
+    arg_parser.add_argument("--results", help="Append the result to this file, one JSON object per line")
+    arg_parser.add_argument("--baseline", help="Compare with the results of this file, as written by --results")
+    arg_parser.add_argument(metavar="COMMAND", nargs=argparse.REMAINDER, dest="command", help="Export command")
+    args = arg_parser.parse_args()
+
+    status, wall, rss = run(args.command, stats=False)
+    if status != 0:
+        print("[-] %s %s failed (error %d)" % (args.plugin, args.source, status))
+        sys.exit(2)
+    output_bytes = os.path.getsize(args.output)
+    stats_file = args.output + '.stats.json'
+    if os.path.exists(stats_file):
+        os.remove(stats_file)
+    status, _, _ = run(args.command, stats=True)
+    if status != 0:
+        print("[-] %s %s failed with stats (error %d)" % (args.plugin, args.source, status))
+        sys.exit(2)
+    nodes = count_nodes(stats_file)
+    result = {
+        'plugin': args.plugin,
+        'source': args.source,
+        'wall_s': wall,
+        'rss_bytes': rss,
+        'output_bytes': output_bytes,
+        'nodes': nodes,
+        'nodes_per_s': nodes / wall if wall > 0 else 0,
+    }
+    line = format_result(result)
+    if args.baseline and os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            for l in f:
+                base = json.loads(l)
+                if base['plugin'] == args.plugin and base['source'] == args.source:
+                    line += '  (time x%.2f, rss x%.2f, output x%.2f)' % (
+                        wall / base['wall_s'] if base['wall_s'] > 0 else 0,
+                        rss / base['rss_bytes'] if base['rss_bytes'] > 0 else 0,
+                        result['output_bytes'] / base['output_bytes'] if base['output_bytes'] > 0 else 0)
+    print(line)
+    if args.results:
+        with open(args.results, 'a') as f:
+            f.write(json.dumps(result) + '\n')
+
+
+if __name__ == '__main__':
+    main()